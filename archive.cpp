@@ -0,0 +1,223 @@
+#include "archive.hpp"
+#include "protocol.hpp"
+#include "workers.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace archive
+{
+    std::string archive_directory = "";
+
+    thread_local int games_fd = -1;
+    thread_local int index_fd = -1;
+    /// End of this worker's archive file, where the next game goes
+    thread_local std::uint64_t games_size = 0;
+    /// game id -> packed board the game was resumed from
+    thread_local std::unordered_map<int, std::string> resumed_starts = {};
+
+    void set_directory(std::string directory)
+    {
+        archive_directory = std::move(directory);
+    }
+
+    bool enabled()
+    {
+        return !archive_directory.empty();
+    }
+
+    const bool write_all(int fd, const char *data, std::size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t written = write(fd, data, length);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                perror("ARCHIVE WRITE");
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    /// Whole entries of the file, a torn one at the end is dropped
+    template <typename Entry>
+    std::vector<Entry> read_entries(const std::string &path)
+    {
+        std::string contents = "";
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return {};
+
+        char buffer[4096];
+        ssize_t bytes;
+        while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+            contents.append(buffer, bytes);
+        if (bytes == -1)
+            perror("ARCHIVE READ");
+        ::close(fd);
+
+        std::vector<Entry> entries(contents.size() / sizeof(Entry));
+        std::memcpy(entries.data(), contents.data(), entries.size() * sizeof(Entry));
+        return entries;
+    }
+
+    /// Replaces the file in one rename, readers see either the old entries or the new ones
+    template <typename Entry>
+    const bool replace_entries(const std::string &path, const std::vector<Entry> &entries)
+    {
+        const std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+        {
+            perror("ARCHIVE SORT");
+            return false;
+        }
+
+        const bool written = write_all(fd, reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(Entry)) && fsync(fd) == 0;
+        ::close(fd);
+        if (!written || rename(temporary.c_str(), path.c_str()) == -1)
+        {
+            perror("ARCHIVE SORT");
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /// Merges the appended entries into the sorted indexes and empties the appended ones
+    void sort_index(std::size_t worker)
+    {
+        const std::string appended_path = index_path(archive_directory, worker);
+        std::vector<index_entry> appended = read_entries<index_entry>(appended_path);
+        if (appended.empty())
+            return;
+
+        std::vector<index_entry> by_game = read_entries<index_entry>(game_index_path(archive_directory, worker));
+        by_game.insert(by_game.end(), appended.begin(), appended.end());
+        // An earlier sort may have stopped before emptying the appended entries, each game is kept once
+        std::sort(by_game.begin(), by_game.end(), [](const index_entry &left, const index_entry &right)
+                  { return std::tie(left.game_id, left.offset) < std::tie(right.game_id, right.offset); });
+        by_game.erase(std::unique(by_game.begin(), by_game.end(), [](const index_entry &left, const index_entry &right)
+                                  { return left.offset == right.offset; }),
+                      by_game.end());
+
+        std::vector<player_entry> by_player = {};
+        by_player.reserve(2 * by_game.size());
+        for (const index_entry &entry : by_game)
+        {
+            by_player.push_back({entry.white_player_id, entry.game_id, entry.offset});
+            by_player.push_back({entry.black_player_id, entry.game_id, entry.offset});
+        }
+        std::sort(by_player.begin(), by_player.end(), [](const player_entry &left, const player_entry &right)
+                  { return std::tie(left.player_id, left.offset) < std::tie(right.player_id, right.offset); });
+
+        if (!replace_entries(player_index_path(archive_directory, worker), by_player) ||
+            !replace_entries(game_index_path(archive_directory, worker), by_game))
+            return;
+
+        if (truncate(appended_path.c_str(), 0) == -1)
+            perror("ARCHIVE SORT");
+    }
+
+    void open()
+    {
+        if (!enabled())
+            return;
+
+        // Whatever the last run appended, in case it didn't get to close
+        sort_index(workers::this_worker);
+        games_fd = ::open(games_path(archive_directory, workers::this_worker).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        index_fd = ::open(index_path(archive_directory, workers::this_worker).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (games_fd == -1 || index_fd == -1)
+        {
+            perror("ARCHIVE OPEN");
+            close();
+            return;
+        }
+
+        const off_t size = lseek(games_fd, 0, SEEK_END);
+        games_size = (size < 0) ? 0 : size;
+    }
+
+    void close()
+    {
+        const bool was_open = index_fd != -1;
+        if (games_fd != -1)
+            ::close(games_fd);
+        if (index_fd != -1)
+            ::close(index_fd);
+        games_fd = -1;
+        index_fd = -1;
+        resumed_starts.clear();
+
+        if (was_open)
+            sort_index(workers::this_worker);
+    }
+
+    void resumed_from(int game_id, std::string packed_board)
+    {
+        if (games_fd != -1)
+            resumed_starts[game_id] = std::move(packed_board);
+    }
+
+    void game_finished(const Board &board, int white_player_id, int black_player_id)
+    {
+        std::string start = "";
+        auto resumed = resumed_starts.find(board.get_game_id());
+        if (resumed != resumed_starts.end())
+        {
+            start = std::move(resumed->second);
+            resumed_starts.erase(resumed);
+        }
+
+        if (games_fd == -1)
+            return;
+
+        const std::vector<ply> &moves = board.played_moves();
+        const std::uint32_t finished_at = static_cast<std::uint32_t>(time(nullptr));
+        const game_header header = {static_cast<std::uint32_t>(board.get_game_id()), white_player_id, black_player_id, finished_at,
+                                    static_cast<std::uint32_t>(moves.size()),
+                                    static_cast<unsigned char>((board.cheat_board ? CheatBoard : 0) | (start.empty() ? 0 : Resumed)),
+                                    static_cast<unsigned char>(board.has_white_won() ? Color::White : Color::Black),
+                                    static_cast<unsigned char>(protocol::win_status(board.end_reason())), 0};
+
+        std::string record(sizeof(header), '\0');
+        std::memcpy(record.data(), &header, sizeof(header));
+        record.append(start);
+        for (const ply &move : moves)
+        {
+            record.push_back(static_cast<char>(move.from));
+            record.push_back(static_cast<char>(move.to));
+        }
+
+        // Index entry only goes in once the whole game is there
+        const index_entry entry = {games_size, header.game_id, white_player_id, black_player_id, finished_at};
+        if (!write_all(games_fd, record.data(), record.size()))
+        {
+            // Part of it may have gone in, the next game starts after it
+            const off_t size = lseek(games_fd, 0, SEEK_END);
+            games_size = (size < 0) ? games_size : size;
+            return;
+        }
+        games_size += record.size();
+        write_all(index_fd, reinterpret_cast<const char *>(&entry), sizeof(entry));
+    }
+
+    void game_closed(int game_id)
+    {
+        resumed_starts.erase(game_id);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "board.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <string>
+
+/// Finished games, appended by every worker to its own archive file with two bytes per ply.
+/// Sidecar indexes of fixed-size entries find them by game id or player without reading the games:
+/// the worker appends to an unsorted one while it runs and sorts it into the other two when it opens and closes
+namespace archive
+{
+    enum game_flags : unsigned char
+    {
+        CheatBoard = 1,
+        /// Moves start from the packed board following the header instead of the starting position
+        Resumed = 2,
+    };
+
+    /// @brief Start of every archived game, followed by the packed board if Resumed, then ply_count from and to cell pairs
+    typedef struct game_header
+    {
+        std::uint32_t game_id;
+        std::int32_t white_player_id;
+        std::int32_t black_player_id;
+        /// Unix time in seconds
+        std::uint32_t finished_at;
+        std::uint32_t ply_count;
+        unsigned char flags;
+        /// Color of the winner
+        unsigned char winner;
+        /// protocol::Status telling why the game ended
+        unsigned char end_status;
+        unsigned char padding;
+    } game_header;
+    static_assert(sizeof(game_header) == 24, "Archived game header changed its size");
+
+    /// @brief Fixed-size entry of the index, game ids are reused so one id can have many
+    typedef struct index_entry
+    {
+        /// Where the game's header starts in the archive file of the same worker
+        std::uint64_t offset;
+        std::uint32_t game_id;
+        std::int32_t white_player_id;
+        std::int32_t black_player_id;
+        std::uint32_t finished_at;
+    } index_entry;
+    static_assert(sizeof(index_entry) == 24, "Archive index entry changed its size");
+
+    /// @brief Entry of the index by player, one for each seat of every game.
+    /// Player ids are the connections' sockets, so a reused descriptor shows up as the same player
+    typedef struct player_entry
+    {
+        std::int32_t player_id;
+        std::uint32_t game_id;
+        /// Where the game's header starts in the archive file of the same worker
+        std::uint64_t offset;
+    } player_entry;
+    static_assert(sizeof(player_entry) == 16, "Archive player index entry changed its size");
+
+    inline std::string games_path(const std::string &directory, std::size_t worker)
+    {
+        return std::format("{}/games-{}.bin", directory, worker);
+    }
+
+    /// Unsorted, entries appended since the index was last sorted
+    inline std::string index_path(const std::string &directory, std::size_t worker)
+    {
+        return std::format("{}/games-{}.idx", directory, worker);
+    }
+
+    /// index_entry sorted by game id, then by offset
+    inline std::string game_index_path(const std::string &directory, std::size_t worker)
+    {
+        return std::format("{}/games-{}.by-game", directory, worker);
+    }
+
+    /// player_entry sorted by player id, then by offset
+    inline std::string player_index_path(const std::string &directory, std::size_t worker)
+    {
+        return std::format("{}/games-{}.by-player", directory, worker);
+    }
+
+    /// Empty directory turns archiving off
+    void set_directory(std::string directory);
+    bool enabled();
+
+    /// Sorts what the last run appended to this worker's index, then opens the archive and the index for appending
+    void open();
+    /// Closes the archive, then sorts the index
+    void close();
+
+    /// Game carries on from a saved position, its moves are archived on top of it
+    void resumed_from(int game_id, std::string packed_board);
+    /// Appends the game that just ended, with the players it had, a walkover already took a seat away
+    void game_finished(const Board &board, int white_player_id, int black_player_id);
+    /// Game closed without finishing
+    void game_closed(int game_id);
+}
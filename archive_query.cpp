@@ -0,0 +1,245 @@
+#include "archive.hpp"
+#include "cells.hpp"
+#include "protocol.hpp"
+#include <format>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <ctime>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/// Entries read from the index at once
+const std::size_t index_batch = 4096;
+
+std::string reason_to_string(unsigned char end_status)
+{
+    switch (end_status)
+    {
+    case protocol::WinKingDead:
+        return "king is dead";
+    case protocol::WinCheckmate:
+        return "checkmate";
+    case protocol::WinWalkover:
+        return "walkover";
+    case protocol::WinStalemate:
+        return "stalemate";
+    }
+    return "unknown";
+}
+
+std::string time_to_string(std::uint32_t finished_at)
+{
+    const time_t seconds = finished_at;
+    tm utc = {};
+    char text[32];
+    gmtime_r(&seconds, &utc);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &utc);
+    return text;
+}
+
+/// Reads exactly length bytes at offset, false if the file is shorter
+const bool read_at(int fd, std::uint64_t offset, char *data, std::size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t bytes_read = pread(fd, data, length, offset);
+        if (bytes_read <= 0)
+            return false;
+        data += bytes_read;
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+    return true;
+}
+
+/// Prints the archived game, its moves too if asked
+const bool print_game(int games_fd, std::size_t worker, const archive::index_entry &entry, bool with_moves)
+{
+    archive::game_header header;
+    if (!read_at(games_fd, entry.offset, reinterpret_cast<char *>(&header), sizeof(header)) || header.game_id != entry.game_id)
+    {
+        std::cout << "Game " << entry.game_id << " is missing from the archive of worker " << worker << '\n';
+        return false;
+    }
+
+    std::cout << "Game " << header.game_id << " (worker " << worker << ") finished " << time_to_string(header.finished_at)
+              << ", white " << header.white_player_id << " black " << header.black_player_id << ": "
+              << color_to_string(static_cast<Color>(header.winner)) << " won by " << reason_to_string(header.end_status)
+              << " after " << header.ply_count << " ply"
+              << ((header.flags & archive::CheatBoard) ? ", cheat board" : "")
+              << ((header.flags & archive::Resumed) ? ", resumed" : "") << '\n';
+
+    if (!with_moves)
+        return true;
+
+    std::uint64_t offset = entry.offset + sizeof(header);
+    if (header.flags & archive::Resumed)
+    {
+        std::string packed(protocol::packed_board_size, '\0');
+        if (!read_at(games_fd, offset, packed.data(), packed.size()))
+            return false;
+        offset += packed.size();
+
+        std::cout << "  from";
+        for (char byte : packed)
+            std::cout << std::format(" {:02x}", static_cast<unsigned char>(byte));
+        std::cout << '\n';
+    }
+
+    std::string plies(2 * header.ply_count, '\0');
+    if (!read_at(games_fd, offset, plies.data(), plies.size()))
+        return false;
+    if (plies.empty())
+        return true;
+
+    std::cout << " ";
+    for (std::size_t index = 0; index < plies.size(); index += 2)
+        std::cout << ' ' << position_to_string(plies[index]) << '-' << position_to_string(plies[index + 1]);
+    std::cout << '\n';
+    return true;
+}
+
+/// Number of whole entries in the file, 0 if it can't be read
+template <typename Entry>
+std::uint64_t entry_count(int fd)
+{
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) == -1)
+        return 0;
+    return status.st_size / sizeof(Entry);
+}
+
+/// First entry of the sorted index whose key isn't below wanted, count if there is none
+template <typename Entry, typename KeyOf>
+std::uint64_t lower_bound(int fd, std::uint64_t count, long wanted, KeyOf key_of)
+{
+    std::uint64_t low = 0;
+    std::uint64_t high = count;
+    while (low < high)
+    {
+        const std::uint64_t middle = low + (high - low) / 2;
+        Entry entry;
+        if (!read_at(fd, middle * sizeof(Entry), reinterpret_cast<char *>(&entry), sizeof(entry)))
+            return count;
+
+        if (key_of(entry) < wanted)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/// Entries of one worker's indexes that match, the sorted ones are searched and only the unsorted rest is read whole
+std::vector<archive::index_entry> find_entries(const std::string &directory, std::size_t worker, long game_id, long player_id)
+{
+    std::vector<archive::index_entry> found = {};
+    auto matches = [game_id, player_id](const archive::index_entry &entry)
+    {
+        return (game_id == -1 || entry.game_id == game_id) &&
+               (player_id == -1 || entry.white_player_id == player_id || entry.black_player_id == player_id);
+    };
+
+    int by_game_fd = open(archive::game_index_path(directory, worker).c_str(), O_RDONLY);
+    const std::uint64_t game_count = entry_count<archive::index_entry>(by_game_fd);
+    if (game_id != -1 || player_id == -1)
+    {
+        // Every game when nothing was asked for
+        std::uint64_t index = (game_id == -1) ? 0 : lower_bound<archive::index_entry>(by_game_fd, game_count, game_id, [](const archive::index_entry &entry)
+                                                                                       { return static_cast<long>(entry.game_id); });
+        archive::index_entry entry;
+        for (; index < game_count && read_at(by_game_fd, index * sizeof(entry), reinterpret_cast<char *>(&entry), sizeof(entry)); ++index)
+        {
+            if (game_id != -1 && entry.game_id != game_id)
+                break;
+            if (matches(entry))
+                found.push_back(entry);
+        }
+    }
+    else
+    {
+        int by_player_fd = open(archive::player_index_path(directory, worker).c_str(), O_RDONLY);
+        const std::uint64_t player_count = entry_count<archive::player_entry>(by_player_fd);
+        std::uint64_t index = lower_bound<archive::player_entry>(by_player_fd, player_count, player_id, [](const archive::player_entry &entry)
+                                                                 { return static_cast<long>(entry.player_id); });
+        archive::player_entry entry;
+        for (; index < player_count && read_at(by_player_fd, index * sizeof(entry), reinterpret_cast<char *>(&entry), sizeof(entry)) && entry.player_id == player_id; ++index)
+            // The game's header has the seats, only the offset and the game id are needed to find it
+            found.push_back({entry.offset, entry.game_id, entry.player_id, entry.player_id, 0});
+        if (by_player_fd != -1)
+            close(by_player_fd);
+    }
+    if (by_game_fd != -1)
+        close(by_game_fd);
+
+    // Appended since the worker last sorted its index
+    int index_fd = open(archive::index_path(directory, worker).c_str(), O_RDONLY);
+    if (index_fd == -1)
+        return found;
+
+    std::vector<archive::index_entry> entries(index_batch);
+    ssize_t bytes_read;
+    while ((bytes_read = read(index_fd, entries.data(), entries.size() * sizeof(archive::index_entry))) > 0)
+        // A torn entry at the end is left for the next run
+        for (std::size_t index = 0; index < bytes_read / sizeof(archive::index_entry); ++index)
+            if (matches(entries[index]))
+                found.push_back(entries[index]);
+    close(index_fd);
+    return found;
+}
+
+/// Looks up archived games through their indexes, without reading the games that don't match
+int main(int argc, char *argv[])
+{
+    std::string directory = "";
+    long game_id = -1;
+    long player_id = -1;
+    bool with_moves = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--game") == 0 && i + 1 < argc)
+            game_id = atol(argv[++i]);
+        else if (strcmp(argv[i], "--player") == 0 && i + 1 < argc)
+            player_id = atol(argv[++i]);
+        else if (strcmp(argv[i], "--moves") == 0)
+            with_moves = true;
+        else
+            directory = argv[i];
+    }
+
+    if (directory.empty())
+    {
+        std::cout << "Usage: " << argv[0] << " DIRECTORY [--game ID] [--player ID] [--moves]\n"
+                  << "Player ids are the server's socket descriptors, which it reuses for later connections,\n"
+                  << "so --player finds every game played over that descriptor, not one person's games" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::size_t found = 0;
+    for (std::size_t worker = 0; access(archive::index_path(directory, worker).c_str(), F_OK) == 0; ++worker)
+    {
+        int games_fd = open(archive::games_path(directory, worker).c_str(), O_RDONLY);
+        if (games_fd == -1)
+        {
+            perror("ARCHIVE OPEN");
+            continue;
+        }
+
+        // A sort cut short by a crash may leave a game in both the sorted and the appended entries
+        std::unordered_set<std::uint64_t> printed = {};
+        for (const archive::index_entry &entry : find_entries(directory, worker, game_id, player_id))
+            if (printed.insert(entry.offset).second && print_game(games_fd, worker, entry, with_moves))
+                ++found;
+
+        close(games_fd);
+    }
+
+    std::cout << found << " game(s)" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,2 @@
+#!/bin/bash
+g++ archive_query.cpp cells.cpp pieces.cpp -Wall --std=c++20 -O2 -o archive_query && ./archive_query "$@"
@@ -0,0 +1,82 @@
+#pragma once
+#include "cells.hpp"
+#include "geometry.hpp"
+#include <array>
+
+/// @brief One bit per cell, bit n is the cell with index n
+__extension__ typedef unsigned __int128 bitboard;
+
+static_assert(sizeof(bitboard) * 8 >= cell_count, "Every cell needs its own bit");
+
+constexpr bitboard cell_bit(cell_index cell)
+{
+    return static_cast<bitboard>(1) << cell;
+}
+
+/// Index of the lowest set bit, the bitboard can't be empty
+constexpr cell_index lowest_cell(bitboard cells)
+{
+    const std::uint64_t low = static_cast<std::uint64_t>(cells);
+    if (low != 0)
+        return static_cast<cell_index>(__builtin_ctzll(low));
+    return static_cast<cell_index>(64 + __builtin_ctzll(static_cast<std::uint64_t>(cells >> 64)));
+}
+
+/// Index of the highest set bit, the bitboard can't be empty
+constexpr cell_index highest_cell(bitboard cells)
+{
+    const std::uint64_t high = static_cast<std::uint64_t>(cells >> 64);
+    if (high != 0)
+        return static_cast<cell_index>(127 - __builtin_clzll(high));
+    return static_cast<cell_index>(63 - __builtin_clzll(static_cast<std::uint64_t>(cells)));
+}
+
+/// Cells are stored column by column and bottom to top, so going up or right always means a bigger index
+constexpr bool direction_increases_index(std::size_t direction)
+{
+    return direction == Direction::Up || direction == Direction::UpRight || direction == Direction::DownRight ||
+           direction == Direction::DiagonalUpRight || direction == Direction::DiagonalDownRight || direction == Direction::Right;
+}
+
+typedef struct bitboard_tables
+{
+    /// Cells along each direction, not including the starting cell
+    std::array<std::array<bitboard, direction_count>, cell_count> rays;
+    std::array<bitboard, cell_count> knight_jumps;
+    std::array<bitboard, cell_count> king_steps;
+} bitboard_tables;
+
+constexpr bitboard_tables build_bitboards()
+{
+    bitboard_tables tables = {};
+
+    for (cell_index from = 0; from < cell_count; ++from)
+    {
+        for (std::size_t direction = 0; direction < direction_count; ++direction)
+            for (cell_index cell : geometry.rays[from][direction])
+                if (cell != no_cell)
+                    tables.rays[from][direction] |= cell_bit(cell);
+
+        for (cell_index cell : geometry.knight_jumps[from])
+            if (cell != no_cell)
+                tables.knight_jumps[from] |= cell_bit(cell);
+
+        for (cell_index cell : geometry.king_steps[from])
+            if (cell != no_cell)
+                tables.king_steps[from] |= cell_bit(cell);
+    }
+
+    return tables;
+}
+
+inline constexpr bitboard_tables masks = build_bitboards();
+
+/// Cells strictly between two cells on one line, empty if they don't share a line
+constexpr bitboard cells_between(cell_index from, cell_index to)
+{
+    const Direction direction = geometry.relations[from][to].direction;
+    if (direction == Direction::NoDirection)
+        return 0;
+
+    return masks.rays[from][direction] & ~masks.rays[to][direction] & ~cell_bit(to);
+}
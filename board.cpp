@@ -1,273 +1,148 @@
 #include "board.hpp"
+#include "geometry.hpp"
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 
-const bool move_is_orthogonal(short row_difference, char abs_column_difference);
-const bool move_is_diagonal(short row_difference, char abs_column_difference);
-short get_row(std::string position);
-char get_column(std::string position);
-bool position_on_end(std::string position, Color color);
+bool position_on_end(cell_index position, Color color);
 bool position_on_pawn_initial_row(short row, char col, Color pawn_color);
-short get_relative_row_difference(short from_row, short to_row, char from_col, char to_col);
-
-const std::size_t cell_count = 91UL;
 
 Board::Board(int _game_id, int _black_player_id, int _white_player_id, bool _cheat_board) : black_player_id(_black_player_id), white_player_id(_white_player_id), game_id(_game_id), cheat_board(_cheat_board)
 {
-    this->all_positions = {};
-    this->white_pieces = {};
-    this->black_pieces = {};
-    this->board = {};
-    this->active_color = Color::Black;
-    board.reserve(cell_count);
-    white_won = false;
-    black_won = false;
-    _white_is_checked = false;
-    _black_is_checked = false;
+    reset();
+}
 
-    std::string row, column, position;
-    unsigned short row_length, row_distance_from_f;
-    for (unsigned short row_index = 1; row_index <= 11; ++row_index)
-    {
-        row = std::to_string(row_index);
-        row_length = line_length.at(row);
-        row_distance_from_f = (row_length - 1) / 2;
+/// Cell mirrored across the middle row of its column, where the other side's piece stands
+constexpr cell_index mirrored_cell(cell_index position)
+{
+    const cell_coordinates &coordinates = cell_table[position];
+    return to_cell(coordinates.column, column_length[coordinates.column] - coordinates.row + 1);
+}
 
-        for (char column_index = 'f' - row_distance_from_f; column_index <= 'f' + row_distance_from_f; ++column_index)
-        {
-            column = column_index;
-            position = column + row;
-            this->all_positions.insert(position);
-
-            field empty_field =
-                {
-                    position,
-                    Piece::NoPiece,
-                    Color::NoColor,
-                };
-
-            board[position] = empty_field;
-        }
+/// @brief Squares of a position with everything derived from them
+typedef struct position_image
+{
+    std::array<square, cell_count> board;
+    std::array<bitboard, 2> occupancy;
+    cell_index white_king_position, black_king_position;
+    std::uint64_t zobrist_hash;
+} position_image;
+
+/// White piece at the position and black one at the mirrored position
+constexpr void place_piece(position_image &image, cell_index position, Piece piece)
+{
+    for (Color color : {Color::White, Color::Black})
+    {
+        const cell_index cell = (color == Color::White) ? position : mirrored_cell(position);
+        const square contents = make_square(piece, color);
+        image.board[cell] = contents;
+        image.occupancy[color] |= cell_bit(cell);
+        image.zobrist_hash ^= zobrist.squares[cell][contents];
     }
+}
+
+constexpr position_image build_start_position()
+{
+    position_image image = {};
+    image.board.fill(empty_square);
 
-#pragma region fill_board
-    std::string symmetrical_position;
     for (const auto &position : king_positions)
     {
-        board[position].color = Color::White;
-        board[position].piece = Piece::King;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::King;
-
-        white_king_position = position;
-        white_pieces.insert(position);
-        black_king_position = symmetrical_position;
-        black_pieces.insert(symmetrical_position);
+        place_piece(image, position, Piece::King);
+        image.white_king_position = position;
+        image.black_king_position = mirrored_cell(position);
     }
-
     for (const auto &position : queen_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Queen;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Queen;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
-
+        place_piece(image, position, Piece::Queen);
     for (const auto &position : rook_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Rook;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Rook;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
+        place_piece(image, position, Piece::Rook);
     for (const auto &position : bishop_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Bishop;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Bishop;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
+        place_piece(image, position, Piece::Bishop);
     for (const auto &position : knight_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Knight;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Knight;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
+        place_piece(image, position, Piece::Knight);
     for (const auto &position : pawn_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Pawn;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Pawn;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
+        place_piece(image, position, Piece::Pawn);
 
-#pragma endregion fill_board
+    return image;
 }
 
+/// Built by the compiler, reset only copies it
+constexpr position_image start_position = build_start_position();
+
 void Board::reset()
 {
-    this->all_positions = {};
-    this->white_pieces = {};
-    this->black_pieces = {};
-    this->board = {};
-    this->active_color = Color::Black;
-    board.reserve(cell_count);
+    board = start_position.board;
+    occupancy = start_position.occupancy;
+    white_king_position = start_position.white_king_position;
+    black_king_position = start_position.black_king_position;
+    zobrist_hash = start_position.zobrist_hash;
+
+    active_color = Color::Black;
+    undo_depth = 0;
+    history.clear();
     white_won = false;
     black_won = false;
     _white_is_checked = false;
     _black_is_checked = false;
+}
 
-    std::string row, column, position;
-    unsigned short row_length, row_distance_from_f;
-    for (unsigned short row_index = 1; row_index <= 11; ++row_index)
-    {
-        row = std::to_string(row_index);
-        row_length = line_length.at(row);
-        row_distance_from_f = (row_length - 1) / 2;
-
-        for (char column_index = 'f' - row_distance_from_f; column_index <= 'f' + row_distance_from_f; ++column_index)
-        {
-            column = column_index;
-            position = column + row;
-            this->all_positions.insert(position);
-
-            field empty_field =
-                {
-                    position,
-                    Piece::NoPiece,
-                    Color::NoColor,
-                };
-
-            board[position] = empty_field;
-        }
-    }
-
-#pragma region fill_board
-    std::string symmetrical_position;
-    for (const auto &position : king_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::King;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::King;
-
-        white_king_position = position;
-        white_pieces.insert(position);
-        black_king_position = symmetrical_position;
-        black_pieces.insert(symmetrical_position);
-    }
-
-    for (const auto &position : queen_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Queen;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Queen;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
-
-    for (const auto &position : rook_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Rook;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Rook;
-
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
-    for (const auto &position : bishop_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Bishop;
-
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Bishop;
+void Board::reuse(int _game_id, int _black_player_id, int _white_player_id, bool _cheat_board)
+{
+    game_id = _game_id;
+    black_player_id = _black_player_id;
+    white_player_id = _white_player_id;
+    cheat_board = _cheat_board;
+    reset();
+}
 
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
-    for (const auto &position : knight_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Knight;
+/// Only way of changing the board, keeps occupancy in sync
+void Board::set_square(cell_index position, square contents)
+{
+    Color previous_color = square_color(board[position]);
+    if (previous_color != Color::NoColor)
+        occupancy[previous_color] &= ~cell_bit(position);
 
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Knight;
+    zobrist_hash ^= zobrist.squares[position][board[position]] ^ zobrist.squares[position][contents];
+    board[position] = contents;
 
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
-    for (const auto &position : pawn_positions)
-    {
-        board[position].color = Color::White;
-        board[position].piece = Piece::Pawn;
+    Color color = square_color(contents);
+    if (color != Color::NoColor)
+        occupancy[color] |= cell_bit(position);
+}
 
-        symmetrical_position = Board::get_symmetrical_position(position);
-        board[symmetrical_position].color = Color::Black;
-        board[symmetrical_position].piece = Piece::Pawn;
+const bool Board::move(std::string_view from, std::string_view to, Color player_color)
+{
+    cell_index from_cell = parse_position(from), to_cell = parse_position(to);
 
-        white_pieces.insert(position);
-        black_pieces.insert(symmetrical_position);
-    }
+    // Positions must exist in the board
+    if (from_cell == no_cell || to_cell == no_cell)
+        return false;
 
-#pragma endregion fill_board
+    return move(from_cell, to_cell, player_color);
 }
 
-const bool Board::move(std::string from, std::string to, Color player_color)
+const bool Board::move(cell_index from, cell_index to, Color player_color)
 {
     // Awaiting second player
     // If both ids are -1, continues assuming testing purposes
     if ((black_player_id == -1) ^ (white_player_id == -1))
         return false;
 
-    if (board.at(from).color != player_color)
-        return false;
-
-    Color capture_color = board.at(to).color;
     // It's the other player's move
     if (player_color != active_color || ((black_player_id == -1) && (white_player_id == -1)))
         return false;
 
+    return replay_move(from, to);
+}
+
+const bool Board::replay_move(cell_index from, cell_index to)
+{
+    if (from >= cell_count || to >= cell_count)
+        return false;
+
+    if (square_color(board[from]) != active_color)
+        return false;
+
     // The game has finished
     if (white_won || black_won)
         return false;
@@ -276,88 +151,113 @@ const bool Board::move(std::string from, std::string to, Color player_color)
     if (!move_is_legal(from, to))
         return false;
 
-    Piece player_piece = board.at(from).piece;
+    // Can't leave own king in check
+    if (move_exposes_king(from, to))
+        return false;
+
+    apply_move(from, to);
+    update_check_flags();
+    history.push_back({from, to});
 
-    // Win check
-    if (board.at(to).piece == Piece::King)
+    // Checkmate check
+    // Gliński rules also give the game to the player who stalemated the opponent
+    move_list replies;
+    if (!has_game_ended() && generate_legal_moves(active_color, replies) == 0)
     {
-        if (player_color == Color::White)
+        // Side that just moved, the active color has switched already
+        if (active_color == Color::Black)
             white_won = true;
         else
             black_won = true;
     }
 
-    // Move
-    board.at(to).color = player_color;
-    board.at(to).piece = player_piece;
+    return true;
+}
 
-    board.at(from).color = Color::NoColor;
-    board.at(from).piece = Piece::NoPiece;
+/// Moves the piece without any validation, returns what is needed to take the move back
+const undo_entry Board::apply_move(cell_index from, cell_index to)
+{
+    undo_entry entry = {{from, to}, board[from], board[to],
+                        white_king_position, black_king_position,
+                        _white_is_checked, _black_is_checked,
+                        white_won, black_won};
 
-    if (player_color == Color::White)
-    {
-        white_pieces.erase(from);
-        white_pieces.insert(to);
-        if (player_piece == Piece::King)
-            white_king_position = to;
-    }
+    Piece player_piece = square_piece(board[from]);
+    Color player_color = square_color(board[from]);
 
-    if (player_color == Color::Black)
+    // Win check
+    if (square_piece(board[to]) == Piece::King)
     {
-        black_pieces.erase(from);
-        black_pieces.insert(to);
-        if (player_piece == Piece::King)
-            black_king_position = to;
+        if (player_color == Color::White)
+            white_won = true;
+        else
+            black_won = true;
     }
 
-    // Capture
-    if (capture_color == Color::White)
-    {
-        white_pieces.erase(to);
-    }
-    else if (capture_color == Color::Black)
+    // Move, overwriting the captured piece
+    set_square(to, board[from]);
+    set_square(from, empty_square);
+
+    if (player_piece == Piece::King)
     {
-        black_pieces.erase(to);
+        if (player_color == Color::White)
+            white_king_position = to;
+        else
+            black_king_position = to;
     }
 
     // Switch active player
-    active_color = (active_color == Color::Black) ? Color::White : Color::Black;
+    switch_active_color();
+
+    return entry;
+}
+
+/// Plays a move without validating it, so it can be taken back with unmake_move
+const bool Board::make_move(ply move)
+{
+    if (undo_depth >= max_undo_depth)
+        return false;
+
+    undo_stack[undo_depth++] = apply_move(move.from, move.to);
+    update_check_flags();
+    return true;
+}
 
-    // // Check check
-    // _white_is_checked = position_under_attack(white_king_position, Color::Black);
-    // _black_is_checked = position_under_attack(black_king_position, Color::White);
-
-    // // Checkmate check
-    // if (player_color == Color::Black && _white_is_checked)
-    // {
-    //     black_won = true;
-    //     for (const auto &move : generate_king_moves(white_king_position))
-    //         if (!position_under_attack(move, Color::Black))
-    //         {
-    //             black_won = false;
-    //             break;
-    //         }
-    // }
-    // if (player_color == Color::White && _black_is_checked)
-    // {
-    //     white_won = true;
-    //     for (const auto &move : generate_king_moves(black_king_position))
-    //         if (!position_under_attack(move, Color::White))
-    //         {
-    //             white_won = false;
-    //             break;
-    //         }
-    // }
+/// Takes back the last move played with make_move
+const bool Board::unmake_move()
+{
+    if (undo_depth == 0)
+        return false;
+
+    const undo_entry &entry = undo_stack[--undo_depth];
+
+    set_square(entry.move.from, entry.moved);
+    set_square(entry.move.to, entry.captured);
+
+    white_king_position = entry.white_king_position;
+    black_king_position = entry.black_king_position;
+    _white_is_checked = entry.white_is_checked;
+    _black_is_checked = entry.black_is_checked;
+    white_won = entry.white_won;
+    black_won = entry.black_won;
+
+    switch_active_color();
 
     return true;
 }
 
+void Board::switch_active_color()
+{
+    active_color = (active_color == Color::Black) ? Color::White : Color::Black;
+    zobrist_hash ^= zobrist.white_to_move;
+}
+
 const std::string Board::serialize() const
 {
     std::string serialized_board = "";
-    for (const auto &position : all_positions)
+    for (cell_index position = 0; position < cell_count; ++position)
     {
-        serialized_board += board.at(position).to_string() + "\n";
+        serialized_board += get_field(position).to_string() + "\n";
     }
     return serialized_board;
 }
@@ -370,49 +270,86 @@ void Board::load_board(std::string serialized_board)
 
     while (getline(board_stream, line, '\n'))
     {
+        if (line.size() < 2)
+            continue;
+
         if (line[0] == 'E')
         {
-            board[line.substr(2)].color = Color::NoColor;
-            board[line.substr(2)].piece = Piece::NoPiece;
+            cell_index position = parse_position(std::string_view(line).substr(2));
+            if (position != no_cell)
+                set_square(position, empty_square);
             continue;
         }
 
-        std::string position;
+        if (line.size() < 4)
+            continue;
+
+        cell_index position = parse_position(std::string_view(line).substr(3));
+        if (position == no_cell)
+            continue;
+
+        Color color = Color::NoColor;
         if (line[0] == 'W')
-        {
-            position = line.substr(3);
-            board[position].color = Color::White;
-        }
+            color = Color::White;
         else if (line[0] == 'B')
-        {
-            position = line.substr(3);
-            board[position].color = Color::Black;
-        }
+            color = Color::Black;
+        else
+            continue;
+
+        Piece piece = Piece::NoPiece;
         switch (line[1])
         {
         case 'K':
-            board[position].piece = Piece::King;
+            piece = Piece::King;
             break;
         case 'Q':
-            board[position].piece = Piece::Queen;
+            piece = Piece::Queen;
             break;
         case 'B':
-            board[position].piece = Piece::Bishop;
+            piece = Piece::Bishop;
             break;
         case 'R':
-            board[position].piece = Piece::Rook;
+            piece = Piece::Rook;
             break;
         case 'N':
-            board[position].piece = Piece::Knight;
+            piece = Piece::Knight;
             break;
         case 'P':
-            board[position].piece = Piece::Pawn;
+            piece = Piece::Pawn;
             break;
 
         default:
-            break;
+            continue;
+        }
+
+        set_square(position, make_square(piece, color));
+        if (piece == Piece::King)
+        {
+            if (color == Color::White)
+                white_king_position = position;
+            else
+                black_king_position = position;
         }
     }
+
+    update_check_flags();
+}
+
+void Board::load_squares(const std::array<square, cell_count> &squares, Color to_move)
+{
+    for (cell_index cell = 0; cell < cell_count; ++cell)
+    {
+        set_square(cell, squares[cell]);
+        if (squares[cell] == make_square(Piece::King, Color::White))
+            white_king_position = cell;
+        else if (squares[cell] == make_square(Piece::King, Color::Black))
+            black_king_position = cell;
+    }
+
+    if (active_color != to_move)
+        switch_active_color();
+    update_check_flags();
+    history.clear();
 }
 
 void Board::show() const
@@ -422,10 +359,10 @@ void Board::show() const
     std::flush(std::cout);
 }
 
-const bool Board::move_is_legal(std::string from, std::string to) const
+const bool Board::move_is_legal(cell_index from, cell_index to) const
 {
     // Positions must exist in the board
-    if (!all_positions.contains(from) || !all_positions.contains(to))
+    if (from >= cell_count || to >= cell_count)
         return false;
 
     // Can't stay in place
@@ -433,15 +370,15 @@ const bool Board::move_is_legal(std::string from, std::string to) const
         return false;
 
     // Can't beat one's own piece
-    Color color = board.at(from).color;
-    if (color == board.at(to).color)
+    Color color = square_color(board[from]);
+    if (color == square_color(board[to]))
         return false;
 
-    Piece piece = board.at(from).piece;
+    Piece piece = square_piece(board[from]);
     switch (piece)
     {
     case Piece::King:
-        return check_king_move(from, to, color);
+        return check_king_move(from, to);
 
     case Piece::Queen:
         return check_queen_move(from, to);
@@ -463,214 +400,310 @@ const bool Board::move_is_legal(std::string from, std::string to) const
     }
 }
 
-const bool Board::check_king_move(std::string from, std::string to, Color player_color) const
+const bool Board::check_king_move(cell_index from, cell_index to) const
 {
-    short from_row = get_row(from), to_row = get_row(to);
-    char from_column = get_column(from), to_column = get_column(to);
+    // Moving into check is rejected for every piece by move_exposes_king
+    const cell_relation &relation = geometry.relations[from][to];
 
-    short row_difference = get_relative_row_difference(from_row, to_row, from_column, to_column);
-    char abs_column_difference = abs(to_column - from_column);
+    return relation.direction != Direction::NoDirection && relation.distance == 1;
+}
 
-    // Let's ignore this one for simplicity
-    // Can't intentionally move into check
-    // //! possible infinite recursion, though it passed a simple test
-    // if (player_color == Color::White && position_under_attack(to, Color::Black))
-    //     return false;
+const bool Board::check_queen_move(cell_index from, cell_index to) const
+{
+    return geometry.relations[from][to].direction != Direction::NoDirection &&
+           path_is_clear(from, to);
+}
 
-    // if (player_color == Color::Black && position_under_attack(to, Color::White))
-    //     return false;
+const bool Board::check_rook_move(cell_index from, cell_index to) const
+{
+    return direction_is_orthogonal(geometry.relations[from][to].direction) &&
+           path_is_clear(from, to);
+}
 
-    return (row_difference == 1 && abs_column_difference <= 1) ||
-           (row_difference == 0 && abs_column_difference <= 1) ||
-           (row_difference == -1 && abs_column_difference <= 2) ||
-           (row_difference == -2 && abs_column_difference == 1);
+const bool Board::check_bishop_move(cell_index from, cell_index to) const
+{
+    return direction_is_diagonal(geometry.relations[from][to].direction) &&
+           path_is_clear(from, to);
 }
 
-const bool Board::check_queen_move(std::string from, std::string to) const
+const bool Board::check_knight_move(cell_index from, cell_index to) const
 {
-    short from_row = get_row(from), to_row = get_row(to);
-    char from_column = get_column(from), to_column = get_column(to);
+    return geometry.relations[from][to].knight_jump;
+}
 
-    short row_difference = get_relative_row_difference(from_row, to_row, from_column, to_column);
-    char abs_column_difference = abs(to_column - from_column);
+const bool Board::check_pawn_move(cell_index from, cell_index to, Color player_color) const
+{
+    // optional TODO: en passant
+    const cell_relation &relation = geometry.relations[from][to];
+    Direction forward = (player_color == Color::White) ? Direction::Up : Direction::Down;
+    Direction forward_right = (player_color == Color::White) ? Direction::UpRight : Direction::DownRight;
+    Direction forward_left = (player_color == Color::White) ? Direction::UpLeft : Direction::DownLeft;
+
+    return ((relation.direction == forward_right || relation.direction == forward_left) &&
+            relation.distance == 1 &&
+            board[to] != empty_square) || // Move in row, only to capture
+           (relation.direction == forward && relation.distance == 1 &&
+            board[to] == empty_square) || // Move in column, unable to capture
+           (position_on_pawn_initial_row(get_row(from), get_column(from), player_color) &&
+            relation.direction == forward && relation.distance == 2 &&
+            board[to] == empty_square && path_is_clear(from, to)) // Two-step move from the initial row
+        ;
+}
 
-    return move_is_diagonal(row_difference, abs_column_difference) ||
-           move_is_orthogonal(row_difference, abs_column_difference);
+/// Sliding pieces can't jump over anything standing between the cells
+const bool Board::path_is_clear(cell_index from, cell_index to) const
+{
+    return (cells_between(from, to) & (occupancy[Color::White] | occupancy[Color::Black])) == 0;
 }
 
-const bool Board::check_rook_move(std::string from, std::string to) const
+/// Fills the buffer with every move that move() would accept from the given player, returns their number
+const std::size_t Board::generate_legal_moves(Color player_color, move_list &moves) const
 {
-    short from_row = get_row(from), to_row = get_row(to);
-    char from_column = get_column(from), to_column = get_column(to);
+    moves.size = 0;
+    if (player_color == Color::NoColor)
+        return 0;
 
-    short row_difference = get_relative_row_difference(from_row, to_row, from_column, to_column);
-    char abs_column_difference = abs(to_column - from_column);
+    const bitboard own_cells = occupancy[player_color];
+    for (bitboard pieces = own_cells; pieces != 0; pieces &= pieces - 1)
+    {
+        cell_index from = lowest_cell(pieces);
+        bitboard targets = 0;
 
-    return move_is_orthogonal(row_difference, abs_column_difference);
-}
+        switch (square_piece(board[from]))
+        {
+        case Piece::King:
+            targets = masks.king_steps[from] & ~own_cells;
+            break;
 
-const bool Board::check_bishop_move(std::string from, std::string to) const
-{
-    short from_row = get_row(from), to_row = get_row(to);
-    char from_column = get_column(from), to_column = get_column(to);
+        case Piece::Knight:
+            targets = masks.knight_jumps[from] & ~own_cells;
+            break;
+
+        case Piece::Queen:
+            generate_sliding_moves(from, 0, direction_count, moves);
+            break;
+
+        case Piece::Rook:
+            generate_sliding_moves(from, 0, orthogonal_direction_count, moves);
+            break;
+
+        case Piece::Bishop:
+            generate_sliding_moves(from, orthogonal_direction_count, direction_count, moves);
+            break;
+
+        case Piece::Pawn:
+        {
+            const bool white = player_color == Color::White;
+            const auto &rays = geometry.rays[from];
+            for (cell_index to : {rays[white ? Direction::Up : Direction::Down][0],
+                                  rays[white ? Direction::Up : Direction::Down][1],
+                                  rays[white ? Direction::UpLeft : Direction::DownLeft][0],
+                                  rays[white ? Direction::UpRight : Direction::DownRight][0]})
+                if (to != no_cell && move_is_legal(from, to))
+                    targets |= cell_bit(to);
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        for (; targets != 0; targets &= targets - 1)
+            moves.push({from, lowest_cell(targets)});
+    }
 
-    short row_difference = get_relative_row_difference(from_row, to_row, from_column, to_column);
-    char abs_column_difference = abs(to_column - from_column);
+    // Drop the moves that would leave own king in check
+    // Unless the king is already attacked, only the king itself and pieces on its lines can expose it
+    const cell_index king = (player_color == Color::White) ? white_king_position : black_king_position;
+    const bool in_check = (player_color == Color::White) ? _white_is_checked : _black_is_checked;
+    std::size_t legal_count = 0;
+    for (std::size_t i = 0; i < moves.size; ++i)
+    {
+        const ply &move = moves.moves[i];
+        if ((!in_check && move.from != king && geometry.relations[king][move.from].direction == Direction::NoDirection) ||
+            !move_exposes_king(move.from, move.to))
+            moves.moves[legal_count++] = move;
+    }
+    moves.size = legal_count;
 
-    return move_is_diagonal(row_difference, abs_column_difference);
+    return moves.size;
 }
 
-const bool Board::check_knight_move(std::string from, std::string to) const
+void Board::generate_sliding_moves(cell_index from, std::size_t first_direction, std::size_t last_direction, move_list &moves) const
 {
-    short from_row = get_row(from), to_row = get_row(to);
-    char from_column = get_column(from), to_column = get_column(to);
+    const Color color = square_color(board[from]);
+
+    for (std::size_t direction = first_direction; direction < last_direction; ++direction)
+        for (cell_index to : geometry.rays[from][direction])
+        {
+            if (to == no_cell)
+                break;
+
+            Color target_color = square_color(board[to]);
+            if (target_color == color)
+                break;
 
-    short row_difference = get_relative_row_difference(from_row, to_row, from_column, to_column);
-    char abs_column_difference = abs(to_column - from_column);
+            moves.push({from, to});
 
-    return (row_difference == 2 && abs_column_difference == 1) ||
-           (row_difference == 1 && abs_column_difference == 2) ||
-           (row_difference == -1 && abs_column_difference == 3) ||
-           (row_difference == -2 && abs_column_difference == 3) ||
-           (row_difference == -3 && abs_column_difference == 1) ||
-           (row_difference == -3 && abs_column_difference == 2);
+            // Captures end the line
+            if (target_color != Color::NoColor)
+                break;
+        }
 }
 
-const bool Board::check_pawn_move(std::string from, std::string to, Color player_color) const
+const bool Board::promote(std::string_view position, Piece to_piece)
 {
-    // optional TODO: en passant
-    short from_row = get_row(from), to_row = get_row(to);
-    char from_column = get_column(from), to_column = get_column(to);
+    cell_index position_cell = parse_position(position);
 
-    short row_difference = get_relative_row_difference(from_row, to_row, from_column, to_column);
-    char abs_column_difference = abs(to_column - from_column);
-
-    if (player_color == Color::White)
-    {
-        return (abs_column_difference == 1 && row_difference == 0) || // Move in row, able to capture
-               (row_difference == 1 && abs_column_difference == 0 &&
-                board.at(to).piece == Piece::NoPiece) || // Move in column, unable to capture
-               (position_on_pawn_initial_row(from_row, from_column, player_color) &&
-                abs_column_difference == 0 && row_difference == 2 &&
-                board.at(to).piece == Piece::NoPiece) // Two-step move from the initial row
-            ;
-    }
+    if (position_cell == no_cell)
+        return false;
 
-    return (abs_column_difference == 1 && row_difference == -1) || // Move in row, able to capture
-           (row_difference == -1 && abs_column_difference == 0 &&
-            board.at(to).piece == Piece::NoPiece) || // Move in column, unable to capture
-           (position_on_pawn_initial_row(from_row, from_column, player_color) &&
-            abs_column_difference == 0 && row_difference == -2 &&
-            board.at(to).piece == Piece::NoPiece) // Two-step move from the initial row
-        ;
+    return promote(position_cell, to_piece);
 }
 
-const bool Board::promote(std::string position, Piece to_piece)
+const bool Board::promote(cell_index position, Piece to_piece)
 {
-    field pawn_field = board.at(position);
+    square pawn_square = board[position];
 
-    if (pawn_field.piece != Piece::Pawn)
+    if (square_piece(pawn_square) != Piece::Pawn)
         return false;
 
-    if (!position_on_end(position, pawn_field.color))
+    if (!position_on_end(position, square_color(pawn_square)))
         return false;
 
-    board.at(position).piece = to_piece;
+    set_square(position, make_square(to_piece, square_color(pawn_square)));
 
     return true;
 }
 
-const bool Board::position_under_attack(std::string checked_position, Color attacker) const
+const bool Board::position_under_attack(cell_index checked_position, Color attacker) const
 {
-    if (attacker == Color::White)
-        for (const auto &white_position : white_pieces)
-        {
-            if (move_is_legal(white_position, checked_position))
-                return true;
-        }
-    else
-        for (const auto &white_position : black_pieces)
-        {
-            if (move_is_legal(white_position, checked_position))
-                return true;
-        }
-    return false;
+    return position_under_attack(checked_position, attacker, occupancy[Color::White] | occupancy[Color::Black], occupancy[attacker]);
 }
 
-const field &Board::get_field(std::string at) const
+/// Looks from the checked cell outwards, so only the few cells a piece could attack from are visited
+const bool Board::position_under_attack(cell_index checked_position, Color attacker, bitboard occupied, bitboard attackers) const
 {
-    return board.at(at);
-}
+    for (bitboard cells = masks.knight_jumps[checked_position] & attackers; cells != 0; cells &= cells - 1)
+        if (square_piece(board[lowest_cell(cells)]) == Piece::Knight)
+            return true;
+
+    for (bitboard cells = masks.king_steps[checked_position] & attackers; cells != 0; cells &= cells - 1)
+        if (square_piece(board[lowest_cell(cells)]) == Piece::King)
+            return true;
+
+    // Pawns capture forward-left and forward-right, so they attack from the opposite directions
+    const auto &rays = geometry.rays[checked_position];
+    for (cell_index cell : {rays[attacker == Color::White ? Direction::DownLeft : Direction::UpLeft][0],
+                            rays[attacker == Color::White ? Direction::DownRight : Direction::UpRight][0]})
+        if (cell != no_cell && (attackers & cell_bit(cell)) && square_piece(board[cell]) == Piece::Pawn)
+            return true;
+
+    for (std::size_t direction = 0; direction < direction_count; ++direction)
+    {
+        bitboard blockers = masks.rays[checked_position][direction] & occupied;
+        if (blockers == 0)
+            continue;
 
-const std::unordered_set<std::string> &Board::get_all_positions() const
-{
-    return all_positions;
+        cell_index cell = direction_increases_index(direction) ? lowest_cell(blockers) : highest_cell(blockers);
+        if (!(attackers & cell_bit(cell)))
+            continue;
+
+        Piece piece = square_piece(board[cell]);
+        if (piece == Piece::Queen ||
+            (piece == Piece::Rook && direction_is_orthogonal(direction)) ||
+            (piece == Piece::Bishop && direction_is_diagonal(direction)))
+            return true;
+    }
+
+    return false;
 }
 
-const std::string Board::get_symmetrical_position(std::string position)
+/// Whether the player's own king would stand attacked after the move
+const bool Board::move_exposes_king(cell_index from, cell_index to) const
 {
-    short row = get_row(position), new_row;
-    std::string column = std::string(1, get_column(position));
-
-    // std::cout << "Position: " << position << "\n"
-    //           << "Col: " << column << " Row:" << row << std::endl;
+    const Color color = square_color(board[from]);
+    const Color enemy = (color == Color::White) ? Color::Black : Color::White;
+
+    cell_index king = (color == Color::White) ? white_king_position : black_king_position;
+    if (square_piece(board[from]) == Piece::King)
+        king = to;
+    // Boards loaded without a king can't be in check
+    else if (board[king] != make_square(Piece::King, color))
+        return false;
 
-    new_row = line_length.at(column) - row + 1;
+    bitboard occupied = ((occupancy[Color::White] | occupancy[Color::Black]) & ~cell_bit(from)) | cell_bit(to);
+    return position_under_attack(king, enemy, occupied, occupancy[enemy] & ~cell_bit(to));
+}
 
-    // std::cout << new_row << std::endl;
+void Board::update_check_flags()
+{
+    _white_is_checked = board[white_king_position] == make_square(Piece::King, Color::White) &&
+                        position_under_attack(white_king_position, Color::Black);
+    _black_is_checked = board[black_king_position] == make_square(Piece::King, Color::Black) &&
+                        position_under_attack(black_king_position, Color::White);
+}
 
-    return std::format("{}{}", column, new_row);
+/// Why the game has ended, reported to the players
+const std::string Board::end_reason() const
+{
+    if (!has_game_ended())
+        return "";
+
+    const Color loser = white_won ? Color::Black : Color::White;
+    const cell_index king = (loser == Color::White) ? white_king_position : black_king_position;
+
+    if (board[king] != make_square(Piece::King, loser))
+        return "king is dead";
+    if ((loser == Color::White) ? _white_is_checked : _black_is_checked)
+        return "checkmate";
+    if (get_player_id(loser) == -1)
+        return "walkover";
+    return "stalemate";
 }
 
-const std::vector<std::string> Board::generate_king_moves(std::string from_position) const
+const field Board::get_field(std::string_view at) const
 {
-    short row = get_row(from_position);
-    char col = get_column(from_position);
+    cell_index position = parse_position(at);
 
-    // Generate all king's moves
-    std::vector<std::pair<short, char>> move_parts =
-        {
-            {row + 1, col - 1},
-            {row + 1, col},
-            {row + 1, col + 1},
-            {row, col - 1},
-            {row, col + 1},
-            {row - 1, col - 2},
-            {row - 1, col - 1},
-            {row - 1, col},
-            {row - 1, col + 1},
-            {row - 1, col + 2},
-            {row - 2, col - 1},
-            {row - 2, col + 1},
-        };
+    if (position == no_cell)
+        throw std::out_of_range("Invalid position: " + std::string(at));
 
-    std::vector<std::string> moves = {};
+    return get_field(position);
+}
 
-    for (const auto &part : move_parts)
-        moves.push_back(std::to_string(part.first) + part.second);
+const field Board::get_field(cell_index at) const
+{
+    return {position_to_string(at), square_piece(board.at(at)), square_color(board.at(at))};
+}
 
-    // Remove those that go outside the board
-    for (size_t i = 0; i < moves.size(); ++i)
-        if (!all_positions.contains(moves.at(i)))
-            moves.erase(moves.begin() + i);
+const std::vector<std::string> &Board::get_all_positions()
+{
+    static const std::vector<std::string> all_positions = []
+    {
+        std::vector<std::string> positions = {};
+        positions.reserve(cell_count);
+        for (cell_index position = 0; position < cell_count; ++position)
+            positions.push_back(position_to_string(position));
+        return positions;
+    }();
 
-    return moves;
+    return all_positions;
 }
 
-const bool move_is_orthogonal(short row_difference, char abs_column_difference)
+const std::string Board::get_symmetrical_position(std::string position)
 {
-    return abs_column_difference == 0 ||             // move in column
-           row_difference == 0 ||                    // move in row
-           abs_column_difference == -row_difference; // move in row flipped on X axis
+    cell_index position_cell = parse_position(position);
+
+    if (position_cell == no_cell)
+        throw std::out_of_range("Invalid position: " + position);
+
+    return position_to_string(get_symmetrical_position(position_cell));
 }
 
-const bool move_is_diagonal(short row_difference, char abs_column_difference)
+const cell_index Board::get_symmetrical_position(cell_index position)
 {
-    if (row_difference > 0)
-        return row_difference == abs_column_difference; // up diagonally
-
-    return abs_column_difference == 2 * row_difference || // left-right
-           2 * abs_column_difference == row_difference;   // down diagonally
+    return mirrored_cell(position);
 }
 
 const bool Board::player_joined(int player_id, Color player_color)
@@ -726,23 +759,22 @@ const int Board::get_player_id(Color player_color) const
     throw std::invalid_argument("Invalid color in player joined: Not a Color");
 }
 
-short get_row(std::string position)
+short get_row(cell_index position)
 {
-    return static_cast<short>(std::stoi(position.substr(1)));
+    return cell_table[position].row;
 }
 
-char get_column(std::string position)
+char get_column(cell_index position)
 {
-    return position[0];
+    return columns[cell_table[position].column];
 }
 
-bool position_on_end(std::string position, Color color)
+bool position_on_end(cell_index position, Color color)
 {
     short row = get_row(position);
-    std::string col = std::to_string(get_column(position));
 
     return (row == 1 && color == Color::Black) ||
-           (row == line_length.at(col) && color == Color::White);
+           (row == column_length[cell_table[position].column] && color == Color::White);
 }
 
 bool position_on_pawn_initial_row(short row, char col, Color pawn_color)
@@ -750,34 +782,3 @@ bool position_on_pawn_initial_row(short row, char col, Color pawn_color)
     return (pawn_color == Color::White && row == 5 - abs('f' - col)) ||
            (pawn_color == Color::Black && row == 7);
 }
-
-// Normalizes into f-column relative movement
-short get_relative_row_difference(short from_row, short to_row, char from_column, char to_column)
-{
-    // d4 g6
-    // normal row difference 2
-    // expected 0
-    // abs... = 2
-    // got 0
-
-    // h6 e5
-    // normal row difference -1
-    // expected -3
-    // abs... = 2
-    // got -3
-
-    short row_difference = to_row - from_row;
-
-    // Relative to itself means no changes
-    if (from_column == 'f')
-        return row_difference;
-
-    // Decrease difference by 1 for each row moved against "board current"
-    if (from_column > 'f' && to_column < from_column)
-        row_difference -= abs(std::max(to_column, 'f') - from_column);
-
-    else if (from_column < 'f' && to_column > from_column)
-        row_difference -= abs(std::min(to_column, 'f') - from_column);
-
-    return row_difference;
-}
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 #include "pieces.hpp"
+#include "cells.hpp"
+#include "bitboard.hpp"
+#include "zobrist.hpp"
+#include <cassert>
+#include <cstdint>
+#include <array>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <format>
 #include <iostream>
@@ -27,47 +31,108 @@ typedef struct field
     }
 } field;
 
+/// @brief Single move, from one cell to another
+typedef struct ply
+{
+    cell_index from;
+    cell_index to;
+} ply;
+
+/// Ten queens in the middle of the board would still fit
+const std::size_t max_moves = 512UL;
+
+/// @brief Fixed-capacity buffer filled by the move generator
+typedef struct move_list
+{
+    std::array<ply, max_moves> moves;
+    std::size_t size;
+
+    void push(ply move)
+    {
+        assert(size < max_moves && "Move generator outgrew max_moves");
+        moves[size++] = move;
+    }
+} move_list;
+
+/// @brief Everything make_move overwrites, so unmake_move can put it back
+typedef struct undo_entry
+{
+    ply move;
+    square moved;
+    square captured;
+    cell_index white_king_position, black_king_position;
+    bool white_is_checked, black_is_checked;
+    bool white_won, black_won;
+} undo_entry;
+
+/// Deep enough for any lookahead the server does
+const std::size_t max_undo_depth = 32UL;
+
 /// @brief Board for Hexagonal Chess
 class Board
 {
 
 protected:
-    std::unordered_map<std::string, field> board;
-    std::unordered_set<std::string> all_positions, white_pieces, black_pieces;
-    std::string white_king_position, black_king_position;
+    /// One byte per cell, indexed by cell_index
+    std::array<square, cell_count> board;
+    /// Cells taken by white and black pieces, indexed by Color
+    std::array<bitboard, 2> occupancy;
+    cell_index white_king_position, black_king_position;
     bool _white_is_checked, _black_is_checked;
     bool black_won, white_won;
     int black_player_id, white_player_id, game_id;
     Color active_color;
+    /// Zobrist key of the position, kept up to date by set_square and every change of the active color
+    std::uint64_t zobrist_hash;
+    std::array<undo_entry, max_undo_depth> undo_stack;
+    unsigned char undo_depth;
+    /// Moves of the game since the board was set up, kept for the archive
+    std::vector<ply> history;
 
 public:
     Board(int game_id = -1, int black_player_id = -1, int white_player_id = -1, bool cheat_board = false);
-    const field &get_field(std::string at) const;
-    const std::unordered_set<std::string> &get_all_positions() const;
+    const field get_field(std::string_view at) const;
+    const field get_field(cell_index at) const;
+    const square get_square(cell_index at) const { return board[at]; }
+    static const std::vector<std::string> &get_all_positions();
     static const std::string get_symmetrical_position(std::string position);
-    const bool move(std::string from, std::string to, Color player_color);
-    const bool promote(std::string position, Piece to);
+    static const cell_index get_symmetrical_position(cell_index position);
+    const bool move(std::string_view from, std::string_view to, Color player_color);
+    const bool move(cell_index from, cell_index to, Color player_color);
+    /// Same checks as move for whoever is to move, the seats don't matter. Used to rebuild games from the journal
+    const bool replay_move(cell_index from, cell_index to);
+    /// Every move played through move or replay_move since the last reset or load_squares
+    const std::vector<ply> &played_moves() const { return history; }
+    const bool make_move(ply move);
+    const bool unmake_move();
+    const bool promote(std::string_view position, Piece to);
+    const bool promote(cell_index position, Piece to);
     const bool white_is_checked() const { return _white_is_checked; }
     const bool black_is_checked() const { return _black_is_checked; }
     const bool has_white_won() const { return white_won; }
     const bool has_black_won() const { return black_won; }
     const bool has_game_ended() const { return white_won || black_won; }
+    const std::string end_reason() const;
     const bool has_white_player() const { return white_player_id != -1; }
     const bool has_black_player() const { return black_player_id != -1; }
     const bool has_both_players() const { return (white_player_id != -1) && (black_player_id != -1); }
     const std::string serialize() const;
     Color get_active_color() const { return active_color; }
+    const std::uint64_t hash() const { return zobrist_hash; }
     void load_board(std::string serialized_board);
+    /// Replaces every square, for positions saved by snapshot
+    void load_squares(const std::array<square, cell_count> &squares, Color to_move);
+    /// Back to the starting position, a copy of an image built at compile time
     void reset();
+    /// Turns a board that's no longer used into a new game's one
+    void reuse(int game_id, int black_player_id, int white_player_id, bool cheat_board);
+    const std::size_t generate_legal_moves(Color player_color, move_list &moves) const;
 
     void show() const;
 
-    const bool state_equal(Board other) const
+    const bool state_equal(const Board &other) const
     {
-        for (const auto &position : all_positions)
-            if (!board.at(position).equal(other.get_field(position)))
-                return false;
-        return true;
+        return board == other.board && active_color == other.active_color;
     }
 
     const Color player_color(int player_id) const
@@ -101,56 +166,37 @@ public:
     }
 
     const int get_player_id(Color player_color) const;
+    const int get_game_id() const { return game_id; }
 
     bool cheat_board;
 
 private:
-    const bool move_is_legal(std::string from, std::string to) const;
-    const bool check_king_move(std::string from, std::string to, Color player_color) const;
-    const bool check_queen_move(std::string from, std::string to) const;
-    const bool check_rook_move(std::string from, std::string to) const;
-    const bool check_bishop_move(std::string from, std::string to) const;
-    const bool check_knight_move(std::string from, std::string to) const;
-    const bool check_pawn_move(std::string from, std::string to, Color color) const;
-    const bool position_under_attack(std::string position, Color attacker) const;
-    const std::vector<std::string> generate_king_moves(std::string from_position) const;
+    const bool move_is_legal(cell_index from, cell_index to) const;
+    const bool check_king_move(cell_index from, cell_index to) const;
+    const bool check_queen_move(cell_index from, cell_index to) const;
+    const bool check_rook_move(cell_index from, cell_index to) const;
+    const bool check_bishop_move(cell_index from, cell_index to) const;
+    const bool check_knight_move(cell_index from, cell_index to) const;
+    const bool check_pawn_move(cell_index from, cell_index to, Color color) const;
+    const bool position_under_attack(cell_index position, Color attacker) const;
+    const bool position_under_attack(cell_index position, Color attacker, bitboard occupied, bitboard attackers) const;
+    const bool move_exposes_king(cell_index from, cell_index to) const;
+    void update_check_flags();
+    const bool path_is_clear(cell_index from, cell_index to) const;
+    const undo_entry apply_move(cell_index from, cell_index to);
+    void generate_sliding_moves(cell_index from, std::size_t first_direction, std::size_t last_direction, move_list &moves) const;
+    void set_square(cell_index position, square contents);
+    void switch_active_color();
 };
 
-const std::vector<std::string>
-    king_positions = {"g1"},
-    queen_positions = {"e1"},
-    rook_positions = {"c1", "i1"},
-    bishop_positions = {"f1", "f2", "f3"},
-    knight_positions = {"d1", "h1"},
-    pawn_positions = {"b1", "c2", "d3", "e4", "f5", "g4", "h3", "i2", "j1"};
+inline constexpr std::array king_positions = {parse_position("g1")};
+inline constexpr std::array queen_positions = {parse_position("e1")};
+inline constexpr std::array rook_positions = {parse_position("c1"), parse_position("i1")};
+inline constexpr std::array bishop_positions = {parse_position("f1"), parse_position("f2"), parse_position("f3")};
+inline constexpr std::array knight_positions = {parse_position("d1"), parse_position("h1")};
+inline constexpr std::array pawn_positions = {parse_position("b1"), parse_position("c2"), parse_position("d3"), parse_position("e4"), parse_position("f5"),
+                                              parse_position("g4"), parse_position("h3"), parse_position("i2"), parse_position("j1")};
 
-const std::unordered_map<std::string, unsigned short> line_length =
-    {
-        {"a", 6},
-        {"b", 7},
-        {"c", 8},
-        {"d", 9},
-        {"e", 10},
-        {"f", 11},
-        {"g", 10},
-        {"h", 9},
-        {"i", 8},
-        {"j", 7},
-        {"k", 6},
-        {"1", 11},
-        {"2", 11},
-        {"3", 11},
-        {"4", 11},
-        {"5", 11},
-        {"6", 11},
-        {"7", 9},
-        {"8", 7},
-        {"9", 5},
-        {"10", 3},
-        {"11", 1}};
-
-const std::string columns = "abcdefghijk";
-
-short get_row(std::string position);
-
-char get_column(std::string position);
\ No newline at end of file
+short get_row(cell_index position);
+
+char get_column(cell_index position);
@@ -270,7 +270,7 @@ class Board:
         self.sprites.pop(from_pos)
 
         print("SEND:", f"move {from_pos} {to_pos}")
-        self.client_socket.send(f"move {from_pos} {to_pos}".encode())
+        self.client_socket.send(f"move {from_pos} {to_pos}\n".encode())
 
         self.awaiting_approval = True
 
@@ -0,0 +1,33 @@
+#include "board_pool.hpp"
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace board_pool
+{
+    typedef std::array<Board, slab_size> slab;
+
+    /// Never freed before the worker exits, boards only move between games and free_boards
+    thread_local std::vector<std::unique_ptr<slab>> slabs = {};
+    thread_local std::vector<Board *> free_boards = {};
+
+    Board *acquire(int game_id, int black_player_id, int white_player_id, bool cheat_board)
+    {
+        if (free_boards.empty())
+        {
+            slabs.push_back(std::make_unique<slab>());
+            for (Board &board : *slabs.back())
+                free_boards.push_back(&board);
+        }
+
+        Board *board = free_boards.back();
+        free_boards.pop_back();
+        board->reuse(game_id, black_player_id, white_player_id, cheat_board);
+        return board;
+    }
+
+    void release(Board *board)
+    {
+        free_boards.push_back(board);
+    }
+}
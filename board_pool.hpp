@@ -0,0 +1,15 @@
+#pragma once
+#include "board.hpp"
+
+/// Boards of a worker's games, allocated a slab at a time and reused after their game closes,
+/// so starting a game doesn't touch the heap
+namespace board_pool
+{
+    /// Boards allocated together whenever the pool runs dry
+    const std::size_t slab_size = 64;
+
+    /// Board in the starting position, owned by the pool
+    Board *acquire(int game_id, int black_player_id, int white_player_id, bool cheat_board);
+    /// Board goes back to this worker's pool, it must not be used anymore
+    void release(Board *board);
+}
@@ -0,0 +1,9 @@
+#include "cells.hpp"
+
+const std::string position_to_string(cell_index cell)
+{
+    if (cell >= cell_count)
+        return "";
+
+    return columns[cell_table[cell].column] + std::to_string(cell_table[cell].row);
+}
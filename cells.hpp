@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// @brief Index of a cell on the board, columns a-k are stored one after another (a1..a6, b1..b7, ..., k1..k6)
+typedef std::uint8_t cell_index;
+
+const std::size_t cell_count = 91UL;
+const std::size_t column_count = 11UL;
+const cell_index no_cell = 0xFF;
+
+const std::string columns = "abcdefghijk";
+
+/// Number of cells in each column, a to k
+constexpr std::array<unsigned short, column_count> column_length = {6, 7, 8, 9, 10, 11, 10, 9, 8, 7, 6};
+
+typedef struct cell_coordinates
+{
+    /// 0 for a, 10 for k
+    unsigned char column;
+    /// Starts at 1, as in the position notation
+    unsigned char row;
+} cell_coordinates;
+
+constexpr std::array<cell_index, column_count + 1> build_column_offsets()
+{
+    std::array<cell_index, column_count + 1> offsets = {};
+    for (std::size_t column = 0; column < column_count; ++column)
+        offsets[column + 1] = offsets[column] + column_length[column];
+    return offsets;
+}
+
+/// First cell of each column, last entry is the cell count
+constexpr std::array<cell_index, column_count + 1> column_offset = build_column_offsets();
+static_assert(column_offset[column_count] == cell_count, "Column lengths must add up to the cell count");
+
+constexpr std::array<cell_coordinates, cell_count> build_cell_coordinates()
+{
+    std::array<cell_coordinates, cell_count> coordinates = {};
+    for (unsigned char column = 0; column < column_count; ++column)
+        for (unsigned char row = 1; row <= column_length[column]; ++row)
+            coordinates[column_offset[column] + row - 1] = {column, row};
+    return coordinates;
+}
+
+/// Cell index -> column and row
+constexpr std::array<cell_coordinates, cell_count> cell_table = build_cell_coordinates();
+
+/// Column and row -> cell index, no_cell if outside of the board
+constexpr cell_index to_cell(int column, int row)
+{
+    if (column < 0 || column >= static_cast<int>(column_count))
+        return no_cell;
+    if (row < 1 || row > column_length[column])
+        return no_cell;
+    return column_offset[column] + row - 1;
+}
+
+/// Parses positions like "f10", returns no_cell for anything that is not on the board
+constexpr cell_index parse_position(std::string_view position)
+{
+    if (position.size() < 2 || position.size() > 3)
+        return no_cell;
+
+    if (position[0] < 'a' || position[0] > 'k')
+        return no_cell;
+
+    int row = 0;
+    for (std::size_t i = 1; i < position.size(); ++i)
+    {
+        if (position[i] < '0' || position[i] > '9')
+            return no_cell;
+        row = row * 10 + (position[i] - '0');
+    }
+
+    return to_cell(position[0] - 'a', row);
+}
+
+const std::string position_to_string(cell_index cell);
@@ -23,12 +23,12 @@ def connect_to_server(client_socket: socket.socket, receiver_thread: threading.T
 
     receiver_thread.start()
 
-    client_socket.send(b"join auto")
+    client_socket.send(b"join auto\n")
 
 
 def end(client_socket: socket.socket) -> None:
     try:
-        client_socket.send(b"leave")
+        client_socket.send(b"leave\n")
         client_socket.shutdown(socket.SHUT_RDWR)
         client_socket.close()
     except OSError as e:
@@ -36,9 +36,19 @@ def end(client_socket: socket.socket) -> None:
 
 
 def receiver(client_socket: socket.socket, message_queue: Queue[str]) -> None:
+    buffered = ""
     while True:
-        message = client_socket.recv(4096).decode()
-        message_queue.put(message)
+        data = client_socket.recv(4096)
+        if not data:
+            break
+        buffered += data.decode()
+
+        # Only whole lines, the rest waits for the next recv
+        end = buffered.rfind("\n")
+        if end == -1:
+            continue
+        message_queue.put(buffered[:end + 1])
+        buffered = buffered[end + 1:]
 
 
 def _send_in_thread(client_socket: socket.socket, message: str, lock: threading.Lock) -> None:
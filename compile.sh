@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ main.cpp board.cpp pieces.cpp player_control.cpp sockets.cpp -Wall --std=c++20
\ No newline at end of file
+g++ main.cpp archive.cpp board.cpp board_pool.cpp cells.cpp hot_restart.cpp journal.cpp matchmaking.cpp metrics.cpp pieces.cpp player_control.cpp protocol.cpp reactor.cpp reactor_uring.cpp server.cpp snapshot.cpp sockets.cpp uring.cpp workers.cpp -Wall --std=c++20 -pthread
\ No newline at end of file
@@ -0,0 +1,166 @@
+#pragma once
+#include "cells.hpp"
+#include <array>
+
+/// @brief Lines a piece can slide along, orthogonal ones first
+enum Direction : unsigned char
+{
+    Up,
+    Down,
+    UpRight,
+    DownRight,
+    UpLeft,
+    DownLeft,
+    DiagonalUpRight,
+    DiagonalDownRight,
+    DiagonalUpLeft,
+    DiagonalDownLeft,
+    Right,
+    Left,
+    NoDirection
+};
+
+const std::size_t direction_count = 12UL;
+const std::size_t orthogonal_direction_count = 6UL;
+/// Longest line on the board has 11 cells
+const std::size_t max_ray_length = 10UL;
+const std::size_t max_jump_count = 12UL;
+
+constexpr bool direction_is_orthogonal(unsigned char direction)
+{
+    return direction < orthogonal_direction_count;
+}
+
+constexpr bool direction_is_diagonal(unsigned char direction)
+{
+    return direction >= orthogonal_direction_count && direction < direction_count;
+}
+
+/// Cells are cut in half vertically, so every cell is described by its column relative to f
+/// and its height in half-cells; neighbours in the next column are one half-cell up or down
+typedef struct hex_step
+{
+    signed char column;
+    signed char height;
+} hex_step;
+
+constexpr std::array<hex_step, direction_count> direction_steps = {{
+    {0, 2},   // Up
+    {0, -2},  // Down
+    {1, 1},   // UpRight
+    {1, -1},  // DownRight
+    {-1, 1},  // UpLeft
+    {-1, -1}, // DownLeft
+    {1, 3},   // DiagonalUpRight
+    {1, -3},  // DiagonalDownRight
+    {-1, 3},  // DiagonalUpLeft
+    {-1, -3}, // DiagonalDownLeft
+    {2, 0},   // Right
+    {-2, 0},  // Left
+}};
+
+constexpr std::array<hex_step, max_jump_count> knight_steps = {{
+    {1, 5},
+    {1, -5},
+    {-1, 5},
+    {-1, -5},
+    {2, 4},
+    {2, -4},
+    {-2, 4},
+    {-2, -4},
+    {3, 1},
+    {3, -1},
+    {-3, 1},
+    {-3, -1},
+}};
+
+/// @brief How two cells relate to each other
+typedef struct cell_relation
+{
+    /// Line going from one cell through the other, NoDirection if there is none
+    Direction direction;
+    /// Number of steps along the direction
+    unsigned char distance;
+    bool knight_jump;
+} cell_relation;
+
+typedef struct geometry_tables
+{
+    /// Cells along each direction, nearest first, padded with no_cell
+    std::array<std::array<std::array<cell_index, max_ray_length>, direction_count>, cell_count> rays;
+    /// Knight targets of each cell, padded with no_cell
+    std::array<std::array<cell_index, max_jump_count>, cell_count> knight_jumps;
+    /// King targets of each cell, padded with no_cell
+    std::array<std::array<cell_index, max_jump_count>, cell_count> king_steps;
+    std::array<std::array<cell_relation, cell_count>, cell_count> relations;
+} geometry_tables;
+
+constexpr cell_index step_from(cell_index cell, hex_step step)
+{
+    int column = cell_table[cell].column - 5;
+    int height = 2 * cell_table[cell].row + (column < 0 ? -column : column);
+
+    column += step.column;
+    height += step.height;
+
+    int abs_column = column < 0 ? -column : column;
+    if (abs_column > 5 || (height - abs_column) % 2 != 0)
+        return no_cell;
+
+    return to_cell(column + 5, (height - abs_column) / 2);
+}
+
+constexpr geometry_tables build_geometry()
+{
+    geometry_tables tables = {};
+
+    for (cell_index from = 0; from < cell_count; ++from)
+    {
+        for (cell_index to = 0; to < cell_count; ++to)
+            tables.relations[from][to] = {Direction::NoDirection, 0, false};
+
+        std::size_t king_step_count = 0;
+        for (std::size_t direction = 0; direction < direction_count; ++direction)
+        {
+            tables.rays[from][direction].fill(no_cell);
+
+            cell_index cell = from;
+            for (std::size_t distance = 0; distance < max_ray_length; ++distance)
+            {
+                cell = step_from(cell, direction_steps[direction]);
+                if (cell == no_cell)
+                    break;
+
+                tables.rays[from][direction][distance] = cell;
+                tables.relations[from][cell] = {static_cast<Direction>(direction), static_cast<unsigned char>(distance + 1), false};
+            }
+
+            if (tables.rays[from][direction][0] != no_cell)
+                tables.king_steps[from][king_step_count++] = tables.rays[from][direction][0];
+        }
+        for (std::size_t i = king_step_count; i < max_jump_count; ++i)
+            tables.king_steps[from][i] = no_cell;
+
+        std::size_t knight_jump_count = 0;
+        for (const auto &step : knight_steps)
+        {
+            cell_index cell = step_from(from, step);
+            if (cell == no_cell)
+                continue;
+
+            tables.knight_jumps[from][knight_jump_count++] = cell;
+            tables.relations[from][cell].knight_jump = true;
+        }
+        for (std::size_t i = knight_jump_count; i < max_jump_count; ++i)
+            tables.knight_jumps[from][i] = no_cell;
+    }
+
+    return tables;
+}
+
+inline constexpr geometry_tables geometry = build_geometry();
+
+static_assert(geometry.relations[parse_position("f6")][parse_position("f11")].direction == Direction::Up);
+static_assert(geometry.relations[parse_position("f6")][parse_position("a1")].direction == Direction::DownLeft);
+static_assert(geometry.relations[parse_position("f6")][parse_position("b4")].direction == Direction::Left);
+static_assert(geometry.relations[parse_position("f6")][parse_position("d3")].knight_jump);
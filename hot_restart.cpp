@@ -0,0 +1,473 @@
+#include "hot_restart.hpp"
+#include "journal.hpp"
+#include "matchmaking.hpp"
+#include "player_control.hpp"
+#include "protocol.hpp"
+#include "server.hpp"
+#include "sockets.hpp"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace hot_restart
+{
+    /// First byte of every record, one record per datagram, the fd rides along as SCM_RIGHTS
+    enum Record : unsigned char
+    {
+        /// Carries the listening socket
+        Listening = 'L',
+        /// Carries the connection, followed by its old fd, game id, connection_flags, rating,
+        /// the length of the unhandled input, the input and the unsent output
+        Connection = 'C',
+        /// Followed by the game id, game_flags, the color to move, the old fds of white and black and the packed board
+        Game = 'G',
+        End = 'E',
+    };
+
+    enum connection_flags : unsigned char
+    {
+        Watch = 1,
+        Binary = 2,
+        Seated = 4,
+    };
+
+    enum game_flags : unsigned char
+    {
+        CheatBoard = 1,
+        Waiting = 2,
+    };
+
+    const std::size_t connection_header_size = 1 + 4 + 4 + 1 + 4 + 4;
+    const std::size_t game_record_size = 1 + 4 + 1 + 1 + 4 + 4 + protocol::packed_board_size;
+
+    std::string handover_path = "";
+    /// Connection of the process taking over, -1 until one asks
+    std::atomic<int> successor = -1;
+
+    /// Filled by every worker as it stops
+    std::mutex export_lock;
+    std::vector<workers::handoff> exported_connections = {};
+    std::vector<journal::recovered_game> exported_games = {};
+
+    /// Taken over from the previous process, waiting for the workers to start
+    std::vector<workers::handoff> adopted_connections = {};
+
+    void put_int(std::string &record, std::uint32_t value)
+    {
+        for (int byte = 0; byte < 4; ++byte)
+            record.push_back(static_cast<char>(value >> (8 * byte)));
+    }
+
+    std::uint32_t get_int(const char *data)
+    {
+        std::uint32_t value = 0;
+        for (int byte = 0; byte < 4; ++byte)
+            value |= static_cast<std::uint32_t>(static_cast<unsigned char>(data[byte])) << (8 * byte);
+        return value;
+    }
+
+    const bool make_address(const std::string &path, sockaddr_un &address)
+    {
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cout << "Handover path is too long: " << path << std::endl;
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    void set_path(std::string path)
+    {
+        handover_path = std::move(path);
+    }
+
+    bool enabled()
+    {
+        return !handover_path.empty();
+    }
+
+    int listen_for_takeover()
+    {
+        sockaddr_un address;
+        if (!enabled() || !make_address(handover_path, address))
+            return -1;
+
+        int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (listener == -1)
+        {
+            perror("HANDOVER SOCKET");
+            return -1;
+        }
+
+        // Left behind by the previous process, which no longer needs it
+        unlink(handover_path.c_str());
+        if (bind(listener, (sockaddr *)&address, sizeof(address)) == -1 || listen(listener, 1) == -1 || !set_nonblock(listener))
+        {
+            perror("HANDOVER LISTEN");
+            close(listener);
+            return -1;
+        }
+        return listener;
+    }
+
+    bool begin_handover(int listener)
+    {
+        int peer = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (peer == -1)
+        {
+            if (errno != EWOULDBLOCK && errno != EINTR)
+                perror("HANDOVER ACCEPT");
+            return false;
+        }
+
+        std::cout << "Handing over to a new process" << std::endl;
+        successor = peer;
+        return true;
+    }
+
+    bool handing_over()
+    {
+        return successor != -1;
+    }
+
+    /// Everything the player hasn't received yet, in order
+    std::string unsent_output(const outbox &outbox)
+    {
+        std::string unsent = "";
+        for (std::size_t index = 0; index < outbox.slices.size(); ++index)
+            unsent.append(*outbox.slices[index], (index == 0) ? outbox.sent : 0);
+        return unsent;
+    }
+
+    void export_worker(const std::vector<int> &open_connections)
+    {
+        std::vector<workers::handoff> connections = {};
+        for (int player_id : open_connections)
+        {
+            workers::handoff connection = {player_id, -1, false, player_control::binary_players.contains(player_id), take_input(player_id)};
+
+            auto game = player_control::games.find(player_id);
+            auto watched = player_control::watched_games.find(player_id);
+            if (game != player_control::games.end())
+            {
+                // Players of finished games just start over without one
+                if (!player_control::boards.at(game->second)->has_game_ended())
+                {
+                    connection.game_id = game->second;
+                    connection.seated = true;
+                }
+            }
+            else if (watched != player_control::watched_games.end())
+            {
+                // Spectators of finished games stop watching
+                auto board = player_control::boards.find(watched->second);
+                if (board != player_control::boards.end() && !board->second->has_game_ended())
+                {
+                    connection.game_id = watched->second;
+                    connection.watch = true;
+                    connection.seated = true;
+                }
+            }
+            else
+                connection.rating = matchmaking::queued_rating(player_id);
+
+            auto queued = player_control::messages.find(player_id);
+            if (queued != player_control::messages.end())
+                connection.unsent_output = unsent_output(queued->second);
+
+            connections.push_back(std::move(connection));
+        }
+
+        std::vector<journal::recovered_game> games = {};
+        for (const auto &[game_id, board] : player_control::boards)
+        {
+            if (board->has_game_ended())
+                continue;
+
+            journal::recovered_game game = {game_id, board->cheat_board, true, workers::this_worker, journal::no_record, {}, protocol::pack_board(*board), board->get_active_color()};
+            game.white_player_id = board->get_player_id(Color::White);
+            game.black_player_id = board->get_player_id(Color::Black);
+            // Restored games with an empty seat have already started
+            game.waiting = !board->has_both_players() && !player_control::recovered_games.contains(game_id);
+            games.push_back(std::move(game));
+        }
+
+        std::lock_guard<std::mutex> guard(export_lock);
+        exported_connections.insert(exported_connections.end(), connections.begin(), connections.end());
+        exported_games.insert(exported_games.end(), games.begin(), games.end());
+    }
+
+    void export_handoffs(const std::vector<workers::handoff> &handoffs)
+    {
+        std::lock_guard<std::mutex> guard(export_lock);
+        exported_connections.insert(exported_connections.end(), handoffs.begin(), handoffs.end());
+    }
+
+    const bool send_record(const std::string &record, int fd = -1)
+    {
+        iovec data = {const_cast<char *>(record.data()), record.size()};
+        msghdr message = {};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        if (fd >= 0)
+        {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+        }
+
+        while (sendmsg(successor, &message, MSG_NOSIGNAL) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            perror("HANDOVER SEND");
+            return false;
+        }
+        return true;
+    }
+
+    bool send_state(int listening_socket)
+    {
+        if (!handing_over())
+            return false;
+
+        bool sent = send_record(std::string(1, Record::Listening), listening_socket);
+
+        std::size_t connection_count = 0;
+        for (const auto &connection : exported_connections)
+        {
+            if (!sent)
+                break;
+
+            std::string record(1, Record::Connection);
+            put_int(record, connection.player_id);
+            put_int(record, connection.game_id);
+            record.push_back(static_cast<char>((connection.watch ? Watch : 0) | (connection.binary ? Binary : 0) | (connection.seated ? Seated : 0)));
+            put_int(record, connection.rating);
+            put_int(record, connection.pending_input.size());
+            record.append(connection.pending_input);
+            record.append(connection.unsent_output);
+
+            // Closed together with this process, the player has to reconnect
+            if (record.size() > max_record_size)
+            {
+                std::cout << "Player " << connection.player_id << " has too much unsent output to hand over" << std::endl;
+                continue;
+            }
+
+            sent = send_record(record, connection.player_id);
+            ++connection_count;
+        }
+
+        for (const auto &game : exported_games)
+        {
+            if (!sent)
+                break;
+
+            std::string record(1, Record::Game);
+            put_int(record, game.game_id);
+            record.push_back(static_cast<char>((game.cheat_board ? CheatBoard : 0) | (game.waiting ? Waiting : 0)));
+            record.push_back(static_cast<char>(game.to_move));
+            put_int(record, game.white_player_id);
+            put_int(record, game.black_player_id);
+            record.append(game.packed_board);
+            sent = send_record(record);
+        }
+
+        if (sent)
+            sent = send_record(std::string(1, Record::End));
+
+        if (sent)
+            std::cout << "Handed over " << connection_count << " connection(s) and " << exported_games.size() << " game(s)" << std::endl;
+
+        close(successor);
+        successor = -1;
+        return sent;
+    }
+
+    /// Returns the record's length, 0 once the previous process is gone, fd is -1 unless one came with it
+    std::size_t receive_record(int peer, char *record, int &fd)
+    {
+        iovec data = {record, max_record_size};
+        msghdr message = {};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        fd = -1;
+        ssize_t length;
+        while ((length = recvmsg(peer, &message, MSG_CMSG_CLOEXEC)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            perror("HANDOVER RECEIVE");
+            return 0;
+        }
+
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+            std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+
+        if (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        {
+            std::cout << "Handover record got cut off" << std::endl;
+            if (fd >= 0)
+                close(fd);
+            return 0;
+        }
+        return length;
+    }
+
+    int take_over(const std::string &path)
+    {
+        sockaddr_un address;
+        if (!make_address(path, address))
+            return -1;
+
+        int peer = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (peer == -1)
+        {
+            perror("HANDOVER SOCKET");
+            return -1;
+        }
+
+        if (connect(peer, (sockaddr *)&address, sizeof(address)) == -1)
+        {
+            perror("HANDOVER CONNECT");
+            close(peer);
+            return -1;
+        }
+
+        int listening_socket = -1;
+        bool complete = false;
+        /// Fds of the previous process -> the same connections in this one
+        std::unordered_map<int, int> new_ids = {};
+        std::vector<journal::recovered_game> games = {};
+        std::vector<char> record(max_record_size);
+
+        while (!complete)
+        {
+            int fd;
+            const std::size_t length = receive_record(peer, record.data(), fd);
+            if (length == 0)
+                break;
+
+            const char *data = record.data();
+            switch (data[0])
+            {
+            case Record::Listening:
+                listening_socket = fd;
+                break;
+            case Record::Connection:
+            {
+                const std::uint32_t input_length = (length >= connection_header_size) ? get_int(data + 14) : 0;
+                if (fd < 0 || length < connection_header_size + input_length)
+                {
+                    std::cout << "Handover sent a broken connection record" << std::endl;
+                    if (fd >= 0)
+                        close(fd);
+                    break;
+                }
+
+                const unsigned char flags = data[9];
+                workers::handoff connection = {fd, static_cast<int>(get_int(data + 5)), (flags & Watch) != 0, (flags & Binary) != 0,
+                                               std::string(data + connection_header_size, input_length)};
+                connection.seated = (flags & Seated) != 0;
+                connection.rating = static_cast<int>(get_int(data + 10));
+                connection.unsent_output.assign(data + connection_header_size + input_length, length - connection_header_size - input_length);
+                new_ids[static_cast<int>(get_int(data + 1))] = fd;
+                adopted_connections.push_back(std::move(connection));
+                break;
+            }
+            case Record::Game:
+            {
+                if (length != game_record_size)
+                {
+                    std::cout << "Handover sent a broken game record" << std::endl;
+                    break;
+                }
+
+                const unsigned char flags = data[5];
+                journal::recovered_game game = {static_cast<int>(get_int(data + 1)), (flags & CheatBoard) != 0, true, 0, journal::no_record, {},
+                                                std::string(data + 15, protocol::packed_board_size), static_cast<Color>(data[6])};
+                game.white_player_id = static_cast<int>(get_int(data + 7));
+                game.black_player_id = static_cast<int>(get_int(data + 11));
+                game.waiting = (flags & Waiting) != 0;
+                games.push_back(std::move(game));
+                break;
+            }
+            case Record::End:
+                complete = true;
+                break;
+            default:
+                if (fd >= 0)
+                    close(fd);
+                break;
+            }
+        }
+        close(peer);
+
+        if (!complete)
+            std::cout << "Handover ended early, taking over what arrived" << std::endl;
+        if (listening_socket < 0)
+        {
+            std::cout << "Handover didn't include the listening socket" << std::endl;
+            for (const auto &connection : adopted_connections)
+                close(connection.player_id);
+            adopted_connections.clear();
+            return -1;
+        }
+
+        for (auto &game : games)
+        {
+            // Players whose connections didn't make it leave an empty seat
+            auto white = new_ids.find(game.white_player_id);
+            auto black = new_ids.find(game.black_player_id);
+            game.white_player_id = (white == new_ids.end()) ? -1 : white->second;
+            game.black_player_id = (black == new_ids.end()) ? -1 : black->second;
+
+            if (game.waiting && game.white_player_id == -1 && game.black_player_id == -1)
+                continue;
+            journal::recovered_games().push_back(std::move(game));
+        }
+
+        std::cout << "Took over " << adopted_connections.size() << " connection(s) and " << journal::recovered_games().size() << " game(s)" << std::endl;
+        return listening_socket;
+    }
+
+    void hand_out_connections()
+    {
+        std::size_t next_worker = 0;
+        for (auto &connection : adopted_connections)
+        {
+            std::size_t worker = next_worker;
+            if (connection.game_id >= 0)
+                worker = workers::owner_of_game(connection.game_id);
+            else
+                next_worker = (next_worker + 1) % workers::worker_count;
+
+            workers::hand_off(worker, std::move(connection));
+        }
+        adopted_connections.clear();
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "workers.hpp"
+#include <string>
+#include <vector>
+
+/// Zero-downtime restarts, the running server passes its listening socket, every connection and the live games
+/// to a new process over a Unix socket. Clients stay connected and games carry on from where they were
+namespace hot_restart
+{
+    /// Longest record passed over the handover socket, connections with more unsent output are dropped
+    const std::size_t max_record_size = 1 << 16;
+
+    /// Unix socket a new process connects to when it takes over, empty path turns handovers off
+    void set_path(std::string path);
+    bool enabled();
+    /// Listens on the path, replacing whatever was bound there, -1 if disabled or it failed
+    int listen_for_takeover();
+
+    /// Accepts the new process, false if nobody was actually waiting. Workers export their state once they stop
+    bool begin_handover(int listener);
+    bool handing_over();
+
+    /// Run by every worker after its loop stopped during a handover, open_connections are all the fds it watched
+    void export_worker(const std::vector<int> &open_connections);
+    /// Connections that were on their way between workers when they stopped
+    void export_handoffs(const std::vector<workers::handoff> &handoffs);
+    /// Passes the listening socket and everything exported to the new process
+    bool send_state(int listening_socket);
+
+    /// Connects to the server listening on path and takes everything it hands over.
+    /// Games go to journal::recovered_games, returns the listening socket or -1 if it failed
+    int take_over(const std::string &path);
+    /// Gives the adopted connections to the workers owning their games, after the workers started
+    void hand_out_connections();
+}
@@ -0,0 +1,335 @@
+#include "journal.hpp"
+#include "protocol.hpp"
+#include "workers.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <format>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace journal
+{
+    std::string journal_directory = "";
+    std::vector<recovered_game> recovered = {};
+    /// Bumped by every sync tick, workers compare it with the last one they synced
+    std::atomic<unsigned> sync_epoch = 0;
+
+    /// @brief Thread writing and syncing one worker's journal, so the worker never waits for the disk
+    typedef struct journal_writer
+    {
+        std::thread thread;
+        std::mutex lock;
+        /// Wakes the writer when records are queued or it should stop
+        std::condition_variable queued_any;
+        /// Wakes the worker waiting for its records to reach the disk
+        std::condition_variable synced_any;
+        /// Records handed over by the worker, the writer swaps them out before writing
+        std::string queued = "";
+        /// Batches handed over and batches on disk
+        std::uint64_t submitted = 0;
+        std::uint64_t synced = 0;
+        bool stopping = false;
+    } journal_writer;
+
+    thread_local int journal_fd = -1;
+    thread_local std::unique_ptr<journal_writer> writer = nullptr;
+    /// Records logged since the last sync
+    thread_local std::string pending = "";
+    thread_local unsigned synced_epoch = 0;
+    /// Records logged since the journal was opened, synced or not
+    thread_local record_index record_count = 0;
+    /// game id -> progress of the games running on this worker
+    thread_local std::unordered_map<int, game_progress> running_games = {};
+
+    std::string journal_path(std::size_t worker)
+    {
+        return std::format("{}/journal-{}.bin", journal_directory, worker);
+    }
+
+    void set_directory(std::string directory)
+    {
+        journal_directory = std::move(directory);
+    }
+
+    bool enabled()
+    {
+        return !journal_directory.empty();
+    }
+
+    /// Whole file or an empty string if it can't be read
+    std::string read_journal(const std::string &path)
+    {
+        std::string contents = "";
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return contents;
+
+        char buffer[4096];
+        ssize_t bytes;
+        while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+            contents.append(buffer, bytes);
+        if (bytes == -1)
+            perror("JOURNAL READ");
+
+        ::close(fd);
+        return contents;
+    }
+
+    void recover()
+    {
+        // Ordered, so games come back in the same order on every worker
+        std::map<int, recovered_game> games = {};
+        /// game id -> bytes of the resumed game's packed board read so far
+        std::unordered_map<int, std::size_t> position_bytes = {};
+
+        for (std::size_t worker = 0; access(journal_path(worker).c_str(), F_OK) == 0; ++worker)
+        {
+            const std::string contents = read_journal(journal_path(worker));
+
+            // A record cut short by the crash is dropped
+            for (std::size_t offset = 0; offset + record_size <= contents.size(); offset += record_size)
+            {
+                const unsigned char *record = reinterpret_cast<const unsigned char *>(contents.data() + offset);
+                const int game_id = record[1] | (record[2] << 8) | (record[3] << 16) | (record[4] << 24);
+
+                switch (record[0])
+                {
+                case Record::GameStarted:
+                    games[game_id] = {game_id, (record[5] & CheatBoard) != 0, (record[5] & Resumed) != 0,
+                                      worker, static_cast<record_index>(offset / record_size), {},
+                                      (record[5] & Resumed) ? std::string(protocol::packed_board_size, '\0') : "",
+                                      static_cast<Color>(record[6])};
+                    position_bytes[game_id] = 0;
+                    break;
+                case Record::Position:
+                    if (games.contains(game_id) && games.at(game_id).resumed && record[5] < protocol::packed_board_size)
+                    {
+                        games.at(game_id).packed_board[record[5]] = static_cast<char>(record[6]);
+                        ++position_bytes[game_id];
+                    }
+                    break;
+                case Record::MovePlayed:
+                    if (games.contains(game_id))
+                        games.at(game_id).moves.push_back({record[5], record[6]});
+                    break;
+                case Record::GameClosed:
+                    games.erase(game_id);
+                    break;
+                default:
+                    std::cout << "Unknown journal record " << static_cast<int>(record[0]) << std::endl;
+                    break;
+                }
+            }
+        }
+
+        recovered.clear();
+        for (auto &game : games)
+        {
+            // Position cut short, only a snapshot can bring the game back
+            if (game.second.resumed && position_bytes[game.first] != protocol::packed_board_size)
+                game.second.packed_board.clear();
+            recovered.push_back(std::move(game.second));
+        }
+        std::cout << "Recovered " << recovered.size() << " game(s)" << std::endl;
+    }
+
+    std::vector<recovered_game> &recovered_games()
+    {
+        return recovered;
+    }
+
+    void remove_stale(std::size_t worker_count)
+    {
+        // Workers only start over their own journals, a later recovery would bring the rest back
+        for (std::size_t worker = worker_count; access(journal_path(worker).c_str(), F_OK) == 0; ++worker)
+            if (unlink(journal_path(worker).c_str()) == -1)
+            {
+                perror("JOURNAL UNLINK");
+                break;
+            }
+    }
+
+    void write_records(int fd, const std::string &records)
+    {
+        std::size_t written = 0;
+        while (written < records.size())
+        {
+            ssize_t bytes = write(fd, records.data() + written, records.size() - written);
+            if (bytes == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                perror("JOURNAL WRITE");
+                break;
+            }
+            written += bytes;
+        }
+
+        if (fdatasync(fd) == -1)
+            perror("JOURNAL SYNC");
+    }
+
+    /// Writes whatever was queued since the last batch, the worker keeps queueing meanwhile
+    void run_writer(journal_writer &state, int fd)
+    {
+        std::string writing = "";
+        std::unique_lock<std::mutex> guard(state.lock);
+        while (true)
+        {
+            state.queued_any.wait(guard, [&state]
+                                  { return state.stopping || state.synced != state.submitted; });
+            if (state.synced == state.submitted)
+                return;
+
+            writing.swap(state.queued);
+            const std::uint64_t batch = state.submitted;
+            guard.unlock();
+
+            write_records(fd, writing);
+            writing.clear();
+
+            guard.lock();
+            state.synced = batch;
+            state.synced_any.notify_all();
+        }
+    }
+
+    void open()
+    {
+        if (!enabled())
+            return;
+
+        record_count = 0;
+        running_games.clear();
+        journal_fd = ::open(journal_path(workers::this_worker).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (journal_fd == -1)
+        {
+            perror("JOURNAL OPEN");
+            return;
+        }
+
+        writer = std::make_unique<journal_writer>();
+        writer->thread = std::thread(run_writer, std::ref(*writer), journal_fd);
+    }
+
+    void close()
+    {
+        if (journal_fd == -1)
+            return;
+
+        sync();
+        {
+            std::lock_guard<std::mutex> guard(writer->lock);
+            writer->stopping = true;
+        }
+        writer->queued_any.notify_one();
+        writer->thread.join();
+        writer.reset();
+
+        ::close(journal_fd);
+        journal_fd = -1;
+    }
+
+    void append_record(Record kind, int game_id, unsigned char first, unsigned char second)
+    {
+        if (journal_fd == -1)
+            return;
+
+        const char record[record_size] = {static_cast<char>(kind),
+                                          static_cast<char>(game_id), static_cast<char>(game_id >> 8),
+                                          static_cast<char>(game_id >> 16), static_cast<char>(game_id >> 24),
+                                          static_cast<char>(first), static_cast<char>(second), 0};
+        pending.append(record, record_size);
+        ++record_count;
+    }
+
+    void game_started(int game_id, bool cheat_board, const std::string &packed_board, Color to_move)
+    {
+        if (journal_fd == -1)
+            return;
+
+        const bool resumed = !packed_board.empty();
+        running_games[game_id] = {record_count, 0};
+        append_record(Record::GameStarted, game_id, (cheat_board ? CheatBoard : 0) | (resumed ? Resumed : 0), resumed ? to_move : 0);
+        for (std::size_t index = 0; index < packed_board.size(); ++index)
+            append_record(Record::Position, game_id, index, packed_board[index]);
+    }
+
+    void move_played(int game_id, cell_index from, cell_index to)
+    {
+        if (journal_fd == -1)
+            return;
+
+        ++running_games[game_id].moves;
+        append_record(Record::MovePlayed, game_id, from, to);
+    }
+
+    void game_closed(int game_id)
+    {
+        // Already closed when it ended
+        if (journal_fd == -1 || running_games.erase(game_id) == 0)
+            return;
+
+        append_record(Record::GameClosed, game_id, 0, 0);
+    }
+
+    game_progress progress(int game_id)
+    {
+        auto running = running_games.find(game_id);
+        if (running == running_games.end())
+            return {no_record, 0};
+        return running->second;
+    }
+
+    void request_sync()
+    {
+        ++sync_epoch;
+        for (std::size_t worker = 0; worker < workers::worker_count; ++worker)
+            workers::wake(worker);
+    }
+
+    /// Hands the pending records to the writer, returns the batch they went out in. Called with the writer's lock held
+    std::uint64_t submit()
+    {
+        if (!pending.empty())
+        {
+            // Writer may not have taken the last batch yet, this one goes out with it
+            writer->queued.append(pending);
+            pending.clear();
+            ++writer->submitted;
+            writer->queued_any.notify_one();
+        }
+        return writer->submitted;
+    }
+
+    void sync_if_due()
+    {
+        const unsigned epoch = sync_epoch.load(std::memory_order_relaxed);
+        if (epoch == synced_epoch || journal_fd == -1)
+            return;
+
+        synced_epoch = epoch;
+        std::lock_guard<std::mutex> guard(writer->lock);
+        submit();
+    }
+
+    void sync()
+    {
+        if (journal_fd == -1)
+            return;
+
+        std::unique_lock<std::mutex> guard(writer->lock);
+        const std::uint64_t batch = submit();
+        writer->synced_any.wait(guard, [batch]
+                                { return writer->synced >= batch; });
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "board.hpp"
+#include "cells.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Append-only log of every worker's games, enough to rebuild the unfinished ones after a crash.
+/// Records are buffered and handed to a writer thread once per sync tick, which writes them with a single fdatasync,
+/// so neither moves nor the worker's event loop wait for the disk
+namespace journal
+{
+    /// Every record is this long, a kind byte, the little endian game id and two argument bytes
+    const std::size_t record_size = 8;
+
+    /// Index of a record in its worker's journal, counted from 0 since the journal was opened
+    typedef std::uint32_t record_index;
+    const record_index no_record = 0xFFFFFFFF;
+
+    enum Record : unsigned char
+    {
+        /// First argument holds the start_flags, the second the color to move of a resumed game
+        GameStarted = 1,
+        /// Arguments are cell indices
+        MovePlayed,
+        GameClosed,
+        /// Follows a resumed start, arguments are an offset into the packed board and the byte there
+        Position,
+    };
+
+    enum start_flags : unsigned char
+    {
+        CheatBoard = 1,
+        /// Carries on from the position in the Position records after the start, the moves alone can't rebuild it
+        Resumed = 2,
+    };
+
+    /// @brief Where a running game is in this worker's journal
+    typedef struct game_progress
+    {
+        record_index start_record;
+        /// Moves logged since the start record
+        std::uint32_t moves;
+    } game_progress;
+
+    /// @brief Unfinished game read back from the journals
+    typedef struct recovered_game
+    {
+        int game_id;
+        bool cheat_board;
+        bool resumed;
+        /// Journal the game was logged to and the record that started it
+        std::size_t worker;
+        record_index start_record;
+        /// Played from packed_board, or from the starting position if it's empty
+        std::vector<ply> moves;
+        std::string packed_board;
+        Color to_move;
+        /// Seats of games handed over by the previous process, -1 for the journal's games
+        int white_player_id = -1;
+        int black_player_id = -1;
+        /// Handed over with one player waiting for an opponent
+        bool waiting = false;
+    } recovered_game;
+
+    /// Empty directory turns journaling off
+    void set_directory(std::string directory);
+    bool enabled();
+
+    /// Reads the journals left by the previous run, the games stay available to every worker through recovered_games
+    void recover();
+    /// Snapshots and games handed over by the previous process are added to it before the workers start
+    std::vector<recovered_game> &recovered_games();
+    /// Removes the journals of workers past worker_count left by a run with more of them
+    void remove_stale(std::size_t worker_count);
+
+    /// Starts this worker's journal over
+    void open();
+    /// Writes out what's left, then closes the journal
+    void close();
+
+    /// A game resumed from packed_board logs it too, so it can be rebuilt without a snapshot
+    void game_started(int game_id, bool cheat_board, const std::string &packed_board = "", Color to_move = Color::White);
+    void move_played(int game_id, cell_index from, cell_index to);
+    void game_closed(int game_id);
+    /// no_record as the start if the game isn't in this worker's journal
+    game_progress progress(int game_id);
+
+    /// Makes every worker write and sync its journal, called by the accepting thread on every sync tick
+    void request_sync();
+    /// Hands this worker's records to its writer if a sync was requested since the last one
+    void sync_if_due();
+    /// Writes and syncs this worker's records right away, returns once they are on disk
+    void sync();
+}
@@ -1,6 +1,14 @@
-#include "board.hpp"
+#include "archive.hpp"
+#include "hot_restart.hpp"
+#include "journal.hpp"
+#include "matchmaking.hpp"
+#include "metrics.hpp"
 #include "player_control.hpp"
+#include "snapshot.hpp"
+#include "reactor.hpp"
 #include "sockets.hpp"
+#include "uring.hpp"
+#include "workers.hpp"
 #include <iostream>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -14,27 +22,25 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <csignal>
-#include <functional>
-#include <memory>
-#include <sstream>
 #include <algorithm>
+#include <chrono>
 
 typedef struct pollfd pollfd;
 int server_socket;
+/// Listens for a new process taking over, -1 without --handover
+int handover_socket = -1;
 socklen_t sockaddr_in_size = sizeof(sockaddr_in);
-
-std::vector<std::string> split(std::string string)
-{
-    std::istringstream iss(string);
-    std::string part;
-    std::vector<std::string> parts = {};
-    while (std::getline(iss, part, ' '))
-    {
-        parts.push_back(part);
-    }
-    return parts;
-}
+/// Interval of the rated matchmaking pairing tick
+int tick_ms = 5000;
+/// Interval of the journal group commit
+int sync_ms = 100;
+/// Interval of saving every board to the snapshot file
+int snapshot_ms = 1000;
+std::chrono::steady_clock::time_point next_tick = {};
+std::chrono::steady_clock::time_point next_sync = {};
+std::chrono::steady_clock::time_point next_snapshot = {};
 
 bool enable_keepalive(int sock)
 {
@@ -68,138 +74,9 @@ bool enable_keepalive(int sock)
     return true;
 }
 
-bool handle_action(const int &player_id, const std::string &action)
-{
-    auto arguments = split(action);
-    if (arguments.size() <= 0)
-    {
-        player_control::messages.at(player_id).push(std::format("error: no command\n"));
-        return true;
-    }
-
-    if (arguments.at(0) == "join")
-    {
-        player_control::add_player(player_id, ((arguments.at(1) == "auto") ? -1 : std::stoi(arguments.at(1))));
-    }
-
-    else if (arguments.at(0) == "move")
-    {
-        if (arguments.size() <= 2)
-        {
-            player_control::messages.at(player_id).push(std::format("error: not enough arguments for move\n"));
-            return true;
-        }
-
-        auto board = player_control::get_board(player_id);
-        if (board->has_game_ended())
-        {
-            player_control::messages.at(player_id).push(std::format("error: game has already ended\n"));
-            return true;
-        }
-
-        if (!board->has_both_players())
-        {
-            player_control::messages.at(player_id).push(std::format("error: still waiting for other player\n"));
-            return true;
-        }
-
-        if (board->move(arguments.at(1), arguments.at(2), board->player_color(player_id)))
-        {
-            player_control::messages.at(player_id).push("accepted\n");
-            int other_player_id = (board->player_color(player_id) == Color::White) ? board->get_player_id(Color::Black) : board->get_player_id(Color::White);
-            player_control::messages.at(other_player_id).push(action + "\n");
-
-            if (board->has_game_ended())
-            {
-                if (board->player_color(player_id) == Color::White)
-                {
-                    if (board->has_white_won())
-                    {
-                        player_control::messages.at(player_id).push("Win: king is dead\n");
-                        player_control::messages.at(other_player_id).push("Loss\n");
-                    }
-                    else
-                    {
-                        player_control::messages.at(player_id).push("Loss\n");
-                        player_control::messages.at(other_player_id).push("Win: king is dead\n");
-                    }
-                }
-                else if (board->player_color(player_id) == Color::Black)
-                {
-                    if (board->has_black_won())
-                    {
-                        player_control::messages.at(player_id).push("Win: king is dead\n");
-                        player_control::messages.at(other_player_id).push("Loss\n");
-                    }
-                    else
-                    {
-                        player_control::messages.at(player_id).push("Loss\n");
-                        player_control::messages.at(other_player_id).push("Win: king is dead\n");
-                    }
-                }
-            }
-        }
-        else
-            player_control::messages.at(player_id).push("blocked\n");
-    }
-
-    else if (arguments.at(0) == "leave")
-    {
-        player_control::remove_player(player_id);
-        return false;
-    }
-
-    else
-    {
-        player_control::messages.at(player_id).push(std::format("unknown command: {}", action));
-    }
-
-    return true;
-}
-
-const bool send_messages(const int &player_id)
-{
-    if (!player_control::messages.contains(player_id))
-    {
-        // std::cout << "Player " << player_id << " has not joined yet" << std::endl;
-        return true;
-    }
-
-    while (!player_control::messages.at(player_id).empty())
-    {
-        const char *message = player_control::messages.at(player_id).front().c_str();
-        int total_bytes_sent = 0, message_length = strlen(message);
-
-        while (total_bytes_sent < message_length)
-        {
-            int bytes_sent = send(player_id, message, strlen(message), 0);
-
-            if (bytes_sent > 0)
-                total_bytes_sent += bytes_sent;
-
-            if (bytes_sent == -1)
-            {
-                // Can't send anything more, move on
-                if (errno == EWOULDBLOCK)
-                    return true;
-
-                // Something bad actually happened
-                perror("SEND DATA");
-                player_control::remove_player(player_id);
-                return false;
-            }
-        }
-        player_control::messages.at(player_id).pop();
-    }
-    return true;
-}
-
 void handle_interrupt(int)
 {
-    player_control::clear_players();
-    shutdown(server_socket, SHUT_RDWR);
-    close(server_socket);
-    exit(EXIT_SUCCESS);
+    workers::request_stop();
 }
 
 void prepare_server(const uint16_t &port)
@@ -243,19 +120,70 @@ void prepare_server(const uint16_t &port)
     }
 }
 
-const bool handle_events(std::vector<pollfd> &poll_vector)
+/// Pairs rated players, syncs the journals and saves snapshots when their ticks are due,
+/// returns milliseconds until the next tick
+int run_due_tick()
 {
-    std::vector<int> elements_to_remove = {};
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_tick)
+    {
+        matchmaking::pair_rated_players();
+        next_tick = now + std::chrono::milliseconds(tick_ms);
+    }
+    auto next = next_tick;
+
+    if (journal::enabled())
+    {
+        if (now >= next_sync)
+        {
+            journal::request_sync();
+            next_sync = now + std::chrono::milliseconds(sync_ms);
+        }
+        next = std::min(next, next_sync);
+    }
 
-    size_t initial_size = poll_vector.size();
+    if (snapshot::enabled())
+    {
+        if (now >= next_snapshot)
+        {
+            snapshot::request_snapshot();
+            next_snapshot = now + std::chrono::milliseconds(snapshot_ms);
+        }
+        next = std::min(next, next_snapshot);
+    }
 
-    pollfd new_element;
+    return std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+}
 
-    short server_events = poll_vector.at(0).revents;
+/// Accepts connections and spreads them over the workers, the poll timeout drives the pairing tick
+void accept_connections()
+{
+    // Negative fds are skipped by poll
+    pollfd polled[2] = {{server_socket, POLLIN, 0}, {handover_socket, POLLIN, 0}};
     sockaddr_in client_address;
     int connection_fd;
-    if (server_events & POLLIN)
+    std::size_t next_worker = 0;
+
+    while (!workers::stop_requested())
     {
+        int number_of_events = poll(polled, 2, run_due_tick());
+
+        if (number_of_events < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            perror("POLL FAIL");
+            break;
+        }
+
+        // Connections still waiting in the backlog are accepted by the new process
+        if ((polled[1].revents & POLLIN) && hot_restart::begin_handover(handover_socket))
+            break;
+
+        if (!(polled[0].revents & POLLIN))
+            continue;
+
         while (true)
         {
             memset(&client_address, 0, sizeof(client_address));
@@ -263,150 +191,287 @@ const bool handle_events(std::vector<pollfd> &poll_vector)
 
             if (connection_fd < 0)
             {
-                if (errno == EWOULDBLOCK)
+                if (errno == EWOULDBLOCK || errno == EINTR)
                     break;
 
                 perror("CONNECTION ERROR");
-                return false;
+                break;
             }
             else
             {
-                std::cout << "Client connected id " << connection_fd << std::endl;
+                std::cout << "Client connected id " << connection_fd << '\n';
+                metrics::count(metrics::ConnectionsAccepted);
             }
 
-            if (!set_nonblock(connection_fd))
-            {
-                return false;
-            }
-            if (!enable_keepalive(connection_fd))
+            if (!set_nonblock(connection_fd) || !enable_keepalive(connection_fd))
             {
-                return false;
+                close(connection_fd);
+                continue;
             }
 
-            new_element = pollfd();
-            new_element.fd = connection_fd;
-            new_element.events = POLLIN | POLLOUT | POLLHUP;
-            new_element.revents = 0;
-
-            poll_vector.push_back(new_element);
+            workers::hand_off(next_worker, {connection_fd, -1, false, false, ""});
+            next_worker = (next_worker + 1) % workers::worker_count;
         }
     }
+}
 
-    for (size_t i = 1; i < initial_size; ++i)
+/// Same as accept_connections, but with a single multishot accept kept on a ring
+void accept_connections_uring()
+{
+    uring::ring ring = {};
+    if (!uring::setup(ring, 64))
     {
-        // Nothing to do
-        if (poll_vector.at(i).revents == 0)
-            continue;
-        bool skip = false;
+        perror("IO_URING SETUP");
+        accept_connections();
+        return;
+    }
 
-        // Player disconnected
-        if ((poll_vector.at(i).revents & (POLLHUP | POLLERR)))
-        {
-            int player_id = poll_vector.at(i).fd;
+    /// user_data of the tick timeout, accepted connections carry 0
+    const unsigned long long tick_user_data = 1;
+    const unsigned long long handover_user_data = 2;
+    const unsigned long long cancel_user_data = 3;
+    __kernel_timespec tick_timeout = {};
+    bool accepting = false;
+    bool ticking = false;
+    bool polling_handover = false;
+    std::size_t next_worker = 0;
+
+    while (!workers::stop_requested())
+    {
+        // Accept has to finish before the ring goes, or a connection could be lost with it
+        if (hot_restart::handing_over() && !accepting)
+            break;
 
-            elements_to_remove.push_back(i);
+        const int until_tick = run_due_tick();
+        if (!ticking)
+        {
+            io_uring_sqe *sqe = uring::get_sqe(ring);
+            if (sqe == nullptr)
+            {
+                perror("IO_URING SUBMIT");
+                break;
+            }
+            tick_timeout.tv_sec = until_tick / 1000;
+            tick_timeout.tv_nsec = (until_tick % 1000) * 1000000LL;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = reinterpret_cast<unsigned long long>(&tick_timeout);
+            sqe->len = 1;
+            sqe->user_data = tick_user_data;
+            ticking = true;
+        }
 
-            // In case player left unsafely
-            if (player_control::messages.contains(player_id))
-                player_control::remove_player(player_id);
+        if (handover_socket >= 0 && !polling_handover && !hot_restart::handing_over())
+        {
+            io_uring_sqe *sqe = uring::get_sqe(ring);
+            if (sqe == nullptr)
+            {
+                perror("IO_URING SUBMIT");
+                break;
+            }
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = handover_socket;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = handover_user_data;
+            polling_handover = true;
+        }
 
-            skip = true;
+        if (!accepting && !hot_restart::handing_over())
+        {
+            io_uring_sqe *sqe = uring::get_sqe(ring);
+            if (sqe == nullptr)
+            {
+                perror("IO_URING SUBMIT");
+                break;
+            }
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = server_socket;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            accepting = true;
         }
 
-        // Incoming message from the client
-        if ((poll_vector.at(i).revents & POLLIN))
+        int result = uring::submit(ring, 1);
+        if (result < 0 && result != -EBUSY)
         {
-            int player_id = poll_vector.at(i).fd;
-            std::string message = "";
-            char message_part[4096];
+            if (result == -EINTR)
+                continue;
+
+            errno = -result;
+            perror("IO_URING ENTER");
+            break;
+        }
 
-            while (true)
+        while (io_uring_cqe *cqe = uring::peek_cqe(ring))
+        {
+            if (cqe->user_data == tick_user_data)
             {
-                memset(message_part, 0, sizeof(message_part));
-                int read_bytes = recv(player_id, message_part, sizeof(message_part), 0);
+                ticking = false;
+                uring::cqe_seen(ring);
+                continue;
+            }
 
-                if (read_bytes == 0)
-                    break;
+            if (cqe->user_data == handover_user_data)
+            {
+                polling_handover = false;
+                const bool ready = cqe->res > 0;
+                uring::cqe_seen(ring);
 
-                if (read_bytes == -1)
+                io_uring_sqe *sqe = nullptr;
+                if (ready && hot_restart::begin_handover(handover_socket) && accepting && (sqe = uring::get_sqe(ring)) != nullptr)
                 {
-                    if (errno != EWOULDBLOCK && !skip)
-                    {
-                        perror("RECEIVE");
-                        player_control::remove_player(player_id);
-                        elements_to_remove.push_back(i);
-                        skip = true;
-                    }
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->user_data = cancel_user_data;
+                }
+                continue;
+            }
 
-                    break;
+            if (cqe->user_data == cancel_user_data)
+            {
+                uring::cqe_seen(ring);
+                continue;
+            }
+
+            int connection_fd = cqe->res;
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                accepting = false;
+            uring::cqe_seen(ring);
+
+            if (connection_fd < 0)
+            {
+                // Kernel without multishot accept
+                if (connection_fd == -EINVAL)
+                {
+                    uring::destroy(ring);
+                    accept_connections();
+                    return;
                 }
 
-                message.append(message_part);
+                // Cancelled by a handover
+                if (connection_fd != -EAGAIN && connection_fd != -EINTR && connection_fd != -ECANCELED)
+                {
+                    errno = -connection_fd;
+                    perror("CONNECTION ERROR");
+                }
+                continue;
             }
 
-            if (message.size() > 0)
-                if (!handle_action(player_id, message))
-                    elements_to_remove.push_back(i);
-        }
+            std::cout << "Client connected id " << connection_fd << '\n';
+            metrics::count(metrics::ConnectionsAccepted);
 
-        // Client ready to receive
-        if ((poll_vector.at(i).revents & POLLOUT))
-        {
-            int player_id = poll_vector.at(i).fd;
-            if (!send_messages(player_id) && !skip)
-                elements_to_remove.push_back(i);
-        }
-    }
+            if (!set_nonblock(connection_fd) || !enable_keepalive(connection_fd))
+            {
+                close(connection_fd);
+                continue;
+            }
 
-    for (size_t i = 0; i < elements_to_remove.size(); ++i)
-    {
-        std::cout << "Removed player form poll id " << poll_vector.at(elements_to_remove.at(i)).fd << std::endl;
-        poll_vector.erase(poll_vector.begin() + elements_to_remove.at(i) - i);
+            workers::hand_off(next_worker, {connection_fd, -1, false, false, ""});
+            next_worker = (next_worker + 1) % workers::worker_count;
+        }
     }
 
-    return true;
+    uring::destroy(ring);
 }
 
 int main(int argc, char *argv[])
 {
+    uint16_t port = 1337;
+    std::size_t thread_count = 1;
+    bool use_io_uring = false;
+    bool recover = false;
+    std::string take_over_path = "";
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            thread_count = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc)
+            tick_ms = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--io-uring") == 0)
+            use_io_uring = true;
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc)
+            journal::set_directory(argv[++i]);
+        else if (strcmp(argv[i], "--sync-ms") == 0 && i + 1 < argc)
+            sync_ms = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+            snapshot::set_path(argv[++i]);
+        else if (strcmp(argv[i], "--snapshot-ms") == 0 && i + 1 < argc)
+            snapshot_ms = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--recover") == 0)
+            recover = true;
+        else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc)
+            archive::set_directory(argv[++i]);
+        else if (strcmp(argv[i], "--handover") == 0 && i + 1 < argc)
+            hot_restart::set_path(argv[++i]);
+        else if (strcmp(argv[i], "--take-over") == 0 && i + 1 < argc)
+            take_over_path = argv[++i];
+        else
+            port = atoi(argv[i]);
+    }
+
     signal(SIGPIPE, SIG_IGN);
-    prepare_server(argc >= 2 ? atoi(argv[1]) : 1337);
     player_control::initialize_cheat_board();
-    signal(SIGINT, handle_interrupt);
 
-    std::vector<pollfd>
-        poll_vector = {pollfd()};
+    if (!snapshot::open())
+        exit(EXIT_FAILURE);
 
-    poll_vector.at(0).fd = server_socket;
-    poll_vector.at(0).events = POLLIN;
+    if (!take_over_path.empty())
+    {
+        // Listening socket comes from the running server, together with its connections and games
+        server_socket = hot_restart::take_over(take_over_path);
+        if (server_socket < 0)
+            exit(EXIT_FAILURE);
+        if (recover)
+            std::cout << "Nothing is recovered when taking over, the games come from the running server" << std::endl;
+    }
+    else
+        prepare_server(port);
 
-    std::cout << "Server started" << std::endl;
-    int number_of_events;
-    while (true)
+    if (recover && take_over_path.empty())
     {
-        number_of_events = poll(&poll_vector.at(0), poll_vector.size(), 5000);
+        if (journal::enabled())
+            journal::recover();
+        if (snapshot::enabled())
+            snapshot::recover();
+        if (!journal::enabled() && !snapshot::enabled())
+            std::cout << "Nothing to recover from without --journal or --snapshot" << std::endl;
+    }
+    if (journal::enabled())
+        journal::remove_stale(thread_count);
+
+    // Workers inherit the mask, so only the accepting thread is interrupted
+    sigset_t interrupt_set;
+    sigemptyset(&interrupt_set);
+    sigaddset(&interrupt_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &interrupt_set, nullptr);
+    metrics::start(thread_count);
+    metrics::attach(thread_count);
+    workers::start(thread_count, use_io_uring ? reactor::run_uring_worker : reactor::run_epoll_worker);
+    pthread_sigmask(SIG_UNBLOCK, &interrupt_set, nullptr);
+    signal(SIGINT, handle_interrupt);
+    hot_restart::hand_out_connections();
+    handover_socket = hot_restart::listen_for_takeover();
 
-        if (number_of_events < 0)
-        {
-            perror("POLL FAIL");
-            break;
-        }
+    std::cout << "Server started with " << thread_count << " worker(s)" << (use_io_uring ? " on io_uring" : "") << std::endl;
+    if (use_io_uring)
+        accept_connections_uring();
+    else
+        accept_connections();
 
-        if (number_of_events == 0)
-        {
-            continue;
-        }
+    workers::request_stop();
+    const std::vector<workers::handoff> leftovers = workers::join();
+    snapshot::close();
+    if (handover_socket >= 0)
+        close(handover_socket);
 
-        if (!handle_events(poll_vector))
-        {
-            std::cout << "Events could not be handled" << std::endl;
-            break;
-        }
+    // Shutting the sockets down would cut off the new process too, they're only closed
+    if (hot_restart::handing_over())
+    {
+        hot_restart::export_handoffs(leftovers);
+        hot_restart::send_state(server_socket);
+        close(server_socket);
+        return 0;
     }
 
-    player_control::clear_players();
     shutdown(server_socket, SHUT_RDWR);
     close(server_socket);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,241 @@
+#include "matchmaking.hpp"
+#include "player_control.hpp"
+#include "workers.hpp"
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace matchmaking
+{
+    /// Turns on the cheat board, never handed out
+    const int cheat_game_id = 42069;
+
+    std::mutex queue_lock;
+    /// Missing color -> open games, oldest first.
+    /// Withdrawn games stay queued and are skipped once they reach the front
+    std::array<std::deque<int>, 2> waiting = {};
+    /// game id -> missing color, only games that can still be claimed
+    std::unordered_map<int, Color> open_games = {};
+
+    /// rating -> players waiting for a rated game, shared by all workers
+    std::multimap<int, ticket> rated_queue = {};
+    /// player id -> its place in rated_queue
+    std::unordered_map<int, std::multimap<int, ticket>::iterator> rated_tickets = {};
+    /// worker -> matches it hasn't picked up yet
+    std::vector<std::vector<match>> match_inboxes = {};
+    /// player id -> rating of the players of this worker waiting in the rating queue or for their match to arrive
+    thread_local std::unordered_map<int, int> rated_players = {};
+
+    thread_local int next_game_id = -1;
+    thread_local std::vector<int> free_game_ids = {};
+
+    int take_open_game(Color missing_color)
+    {
+        auto &queue = waiting[missing_color];
+        while (!queue.empty())
+        {
+            const int game_id = queue.front();
+            queue.pop_front();
+
+            auto open = open_games.find(game_id);
+            if (open != open_games.end() && open->second == missing_color)
+            {
+                open_games.erase(open);
+                return game_id;
+            }
+        }
+        return -1;
+    }
+
+    int claim(Color preferred_color)
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        if (preferred_color != Color::NoColor)
+            return take_open_game(preferred_color);
+
+        const int game_id = take_open_game(Color::Black);
+        return (game_id != -1) ? game_id : take_open_game(Color::White);
+    }
+
+    void publish(int game_id, Color missing_color)
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        open_games[game_id] = missing_color;
+
+        auto &queue = waiting[missing_color];
+        queue.push_back(game_id);
+
+        // Games paired by explicit ids are never claimed, so drop the withdrawn ones
+        // once they outnumber the open ones, which keeps publishing constant time on average
+        if (queue.size() > 2 * open_games.size() + 16)
+        {
+            std::deque<int> still_open = {};
+            for (int queued_id : queue)
+            {
+                auto open = open_games.find(queued_id);
+                if (open != open_games.end() && open->second == missing_color)
+                    still_open.push_back(queued_id);
+            }
+            queue.swap(still_open);
+        }
+    }
+
+    void withdraw(int game_id)
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        open_games.erase(game_id);
+    }
+
+    /// Expects queue_lock to be held
+    void insert_ticket(const ticket &waiting)
+    {
+        auto queued = rated_tickets.find(waiting.player_id);
+        if (queued != rated_tickets.end())
+            rated_queue.erase(queued->second);
+        rated_tickets[waiting.player_id] = rated_queue.insert({waiting.rating, waiting});
+    }
+
+    void queue_rated(const int &player_id, int rating)
+    {
+        rated_players[player_id] = rating;
+
+        std::lock_guard<std::mutex> guard(queue_lock);
+        insert_ticket({player_id, rating, workers::this_worker, 0});
+    }
+
+    bool is_queued(const int &player_id)
+    {
+        return rated_players.contains(player_id);
+    }
+
+    int queued_rating(const int &player_id)
+    {
+        auto queued = rated_players.find(player_id);
+        return (queued == rated_players.end()) ? -1 : queued->second;
+    }
+
+    bool take_queued(const int &player_id)
+    {
+        if (rated_players.erase(player_id) == 0)
+            return false;
+
+        // Still queued if no tick has paired it yet
+        std::lock_guard<std::mutex> guard(queue_lock);
+        auto queued = rated_tickets.find(player_id);
+        if (queued != rated_tickets.end())
+        {
+            rated_queue.erase(queued->second);
+            rated_tickets.erase(queued);
+        }
+        return true;
+    }
+
+    void requeue(ticket waiting)
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        insert_ticket(waiting);
+    }
+
+    /// Expects queue_lock to be held
+    void push_match(std::size_t worker, match match)
+    {
+        if (match_inboxes.size() < workers::worker_count)
+            match_inboxes.resize(workers::worker_count);
+        match_inboxes.at(worker).push_back(match);
+    }
+
+    void pair_rated_players()
+    {
+        std::vector<bool> woken(workers::worker_count, false);
+        std::size_t pairs = 0;
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+
+            // Sorted by rating, so pairing neighbours gives the smallest spread overall
+            auto next = rated_queue.begin();
+            while (next != rated_queue.end())
+            {
+                auto first = next++;
+                if (next == rated_queue.end())
+                {
+                    ++first->second.ticks_waited;
+                    break;
+                }
+
+                const unsigned waited = std::max(first->second.ticks_waited, next->second.ticks_waited);
+                if (next->first - first->first > rating_spread_step * static_cast<int>(waited + 1))
+                {
+                    ++first->second.ticks_waited;
+                    continue;
+                }
+
+                const ticket &host = first->second;
+                push_match(host.worker, {host.player_id, -1, next->second});
+                woken.at(host.worker) = true;
+                ++pairs;
+
+                rated_tickets.erase(first->second.player_id);
+                rated_tickets.erase(next->second.player_id);
+                rated_queue.erase(first);
+                next = rated_queue.erase(next);
+            }
+        }
+
+        for (std::size_t worker = 0; worker < woken.size(); ++worker)
+            if (woken.at(worker))
+                workers::wake(worker);
+
+        if (pairs > 0)
+            std::cout << "Paired " << pairs << " rated game(s)" << '\n';
+    }
+
+    void post_match(std::size_t worker, match match)
+    {
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            push_match(worker, match);
+        }
+        workers::wake(worker);
+    }
+
+    std::vector<match> take_matches()
+    {
+        std::vector<match> matches = {};
+
+        std::lock_guard<std::mutex> guard(queue_lock);
+        if (workers::this_worker < match_inboxes.size())
+            matches.swap(match_inboxes.at(workers::this_worker));
+        return matches;
+    }
+
+    int allocate_game_id()
+    {
+        if (next_game_id == -1)
+            next_game_id = workers::this_worker;
+
+        // Players may have picked any id themselves, so skip the ones in use
+        while (!free_game_ids.empty())
+        {
+            const int game_id = free_game_ids.back();
+            free_game_ids.pop_back();
+            if (!player_control::boards.contains(game_id))
+                return game_id;
+        }
+
+        int game_id = next_game_id;
+        while (game_id == cheat_game_id || player_control::boards.contains(game_id))
+            game_id += workers::worker_count;
+        next_game_id = game_id + workers::worker_count;
+        return game_id;
+    }
+
+    void release_game_id(int game_id)
+    {
+        if (game_id != cheat_game_id && game_id < next_game_id)
+            free_game_ids.push_back(game_id);
+    }
+}
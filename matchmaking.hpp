@@ -0,0 +1,61 @@
+#pragma once
+#include "pieces.hpp"
+#include <cstddef>
+#include <vector>
+
+/// Pairs auto-joining players and hands out game ids, both in constant time
+namespace matchmaking
+{
+    /// Takes an open game for an auto-joining player off the queues, -1 if a new one has to be created.
+    /// Queues are shared by all workers, the game may live on another one
+    int claim(Color preferred_color = Color::NoColor);
+    /// Game waiting for a player of the missing color
+    void publish(int game_id, Color missing_color);
+    /// Game got its second player or closed
+    void withdraw(int game_id);
+
+    /// Ratings two players may differ by to be paired, grows by this much with every tick they wait
+    const int rating_spread_step = 100;
+
+    /// @brief Player waiting for an opponent of a similar rating
+    typedef struct ticket
+    {
+        int player_id;
+        int rating;
+        /// Worker the connection lives on
+        std::size_t worker;
+        /// Pairing ticks it has waited through without an opponent
+        unsigned ticks_waited;
+    } ticket;
+
+    /// @brief Pair found by a tick, delivered to the worker of player_id
+    typedef struct match
+    {
+        int player_id;
+        /// -1 starts a new game, the partner is then sent to it
+        int game_id;
+        ticket partner;
+    } match;
+
+    /// Holds the player of this worker until a tick finds an opponent with a similar rating
+    void queue_rated(const int &player_id, int rating);
+    bool is_queued(const int &player_id);
+    /// -1 if the player isn't waiting for a rated game
+    int queued_rating(const int &player_id);
+    /// Takes the player out of the rating queue, false if it wasn't waiting there
+    bool take_queued(const int &player_id);
+    /// Puts a ticket back after its match fell through
+    void requeue(ticket waiting);
+
+    /// Pairs queued players with the closest ratings in one go, run periodically by the accepting thread
+    void pair_rated_players();
+    /// Sends a match to the worker holding its player
+    void post_match(std::size_t worker, match match);
+    /// Matches for players of this worker
+    std::vector<match> take_matches();
+
+    /// Game id that isn't in use and belongs to this worker
+    int allocate_game_id();
+    /// Game closed, its id can be handed out again
+    void release_game_id(int game_id);
+}
@@ -0,0 +1,134 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <format>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace metrics
+{
+    /// @brief Everything one thread counts, on its own cache lines
+    typedef struct alignas(64) thread_block
+    {
+        std::array<std::atomic<std::uint64_t>, counter_count> counters;
+        std::array<std::atomic<std::uint64_t>, gauge_count> gauges;
+        std::array<std::atomic<std::uint64_t>, bucket_count> latency;
+        std::atomic<std::uint64_t> latency_max;
+    } thread_block;
+
+    const std::array<const char *, counter_count> counter_names = {
+        "connections_accepted", "commands_handled", "moves_accepted", "moves_blocked",
+        "games_started", "games_finished", "bytes_in", "bytes_out"};
+    const std::array<const char *, gauge_count> gauge_names = {"open_connections", "active_games"};
+    /// Reported latency percentiles, in tenths of a percent
+    const std::array<std::pair<unsigned, const char *>, 4> percentiles = {{{500, "p50"}, {900, "p90"}, {990, "p99"}, {999, "p99.9"}}};
+
+    /// Allocated before any thread attaches and kept until the process exits
+    std::vector<std::unique_ptr<thread_block>> blocks = {};
+    thread_local thread_block *local = nullptr;
+
+    /// Only the owning thread writes, so a plain load and store are enough
+    void add(std::atomic<std::uint64_t> &value, std::uint64_t amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    void start(std::size_t worker_count)
+    {
+        blocks.clear();
+        for (std::size_t index = 0; index <= worker_count; ++index)
+            blocks.push_back(std::make_unique<thread_block>());
+    }
+
+    void attach(std::size_t index)
+    {
+        local = (index < blocks.size()) ? blocks.at(index).get() : nullptr;
+    }
+
+    void count(Counter counter, std::uint64_t amount)
+    {
+        if (local != nullptr)
+            add(local->counters[counter], amount);
+    }
+
+    void set(Gauge gauge, std::uint64_t value)
+    {
+        if (local != nullptr)
+            local->gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+
+    void record_latency(std::uint64_t nanoseconds)
+    {
+        if (local == nullptr)
+            return;
+
+        add(local->latency[bucket_of(nanoseconds)], 1);
+        if (nanoseconds > local->latency_max.load(std::memory_order_relaxed))
+            local->latency_max.store(nanoseconds, std::memory_order_relaxed);
+    }
+
+    std::size_t bucket_of(std::uint64_t value)
+    {
+        if (value < sub_bucket_count)
+            return value;
+
+        // Highest set bit picks the power of two, the next four bits the sub-bucket
+        const std::size_t exponent = 63 - __builtin_clzll(value);
+        return (exponent - 3) * sub_bucket_count + ((value >> (exponent - 4)) & (sub_bucket_count - 1));
+    }
+
+    std::uint64_t bucket_floor(std::size_t bucket)
+    {
+        if (bucket < sub_bucket_count)
+            return bucket;
+
+        const std::size_t exponent = bucket / sub_bucket_count + 3;
+        return (sub_bucket_count + bucket % sub_bucket_count) << (exponent - 4);
+    }
+
+    std::string report()
+    {
+        std::array<std::uint64_t, counter_count> counters = {};
+        std::array<std::uint64_t, gauge_count> gauges = {};
+        std::array<std::uint64_t, bucket_count> latency = {};
+        std::uint64_t latency_count = 0;
+        std::uint64_t latency_max = 0;
+
+        for (const auto &block : blocks)
+        {
+            for (std::size_t index = 0; index < counter_count; ++index)
+                counters[index] += block->counters[index].load(std::memory_order_relaxed);
+            for (std::size_t index = 0; index < gauge_count; ++index)
+                gauges[index] += block->gauges[index].load(std::memory_order_relaxed);
+            for (std::size_t index = 0; index < bucket_count; ++index)
+            {
+                const std::uint64_t hits = block->latency[index].load(std::memory_order_relaxed);
+                latency[index] += hits;
+                latency_count += hits;
+            }
+            latency_max = std::max(latency_max, block->latency_max.load(std::memory_order_relaxed));
+        }
+
+        std::string text = "stats\n";
+        for (std::size_t index = 0; index < counter_count; ++index)
+            text += std::format("{} {}\n", counter_names[index], counters[index]);
+        for (std::size_t index = 0; index < gauge_count; ++index)
+            text += std::format("{} {}\n", gauge_names[index], gauges[index]);
+
+        text += std::format("command_latency_ns count {}", latency_count);
+        std::size_t bucket = 0;
+        std::uint64_t seen = 0;
+        for (const auto &[tenths, name] : percentiles)
+        {
+            // Smallest bucket that covers the share of the commands
+            const std::uint64_t needed = (latency_count * tenths + 999) / 1000;
+            while (bucket + 1 < bucket_count && seen + latency[bucket] < needed)
+                seen += latency[bucket++];
+            text += std::format(" {} {}", name, (latency_count == 0) ? 0 : bucket_floor(bucket));
+        }
+        text += std::format(" max {}\n\n", latency_max);
+        return text;
+    }
+}
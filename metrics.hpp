@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Counters and latency histograms, every thread writes only its own block with relaxed atomics,
+/// so counting never takes a lock or bounces a cache line. Reports add the blocks up
+namespace metrics
+{
+    enum Counter : unsigned char
+    {
+        ConnectionsAccepted,
+        CommandsHandled,
+        MovesAccepted,
+        MovesBlocked,
+        GamesStarted,
+        GamesFinished,
+        BytesIn,
+        BytesOut,
+        counter_count,
+    };
+
+    /// Set by every worker as it goes, the report adds up the last values
+    enum Gauge : unsigned char
+    {
+        OpenConnections,
+        ActiveGames,
+        gauge_count,
+    };
+
+    /// Buckets per power of two, values are kept to within 1/16 of themselves
+    const std::size_t sub_bucket_count = 16;
+    /// Enough for any 64 bit value
+    const std::size_t bucket_count = 61 * sub_bucket_count;
+
+    /// Sets up a block for every worker and one more for the accepting thread
+    void start(std::size_t worker_count);
+    /// Points the calling thread at its block, threads that never attach count nothing
+    void attach(std::size_t index);
+
+    void count(Counter counter, std::uint64_t amount = 1);
+    void set(Gauge gauge, std::uint64_t value);
+    /// Time one command took to handle
+    void record_latency(std::uint64_t nanoseconds);
+
+    /// Histogram bucket holding the value, log-linear like an HDR histogram
+    std::size_t bucket_of(std::uint64_t value);
+    /// Smallest value that lands in the bucket
+    std::uint64_t bucket_floor(std::size_t bucket);
+
+    /// Totals of every thread as "name value" lines ending with an empty one, answer to the stats command
+    std::string report();
+}
@@ -0,0 +1,86 @@
+#include "board.hpp"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+/// Counts leaf positions reachable from the board in exactly depth moves
+unsigned long long perft(Board &board, int depth)
+{
+    if (depth == 0)
+        return 1;
+
+    // King was captured, nothing more to play
+    if (board.has_game_ended())
+        return 0;
+
+    move_list moves;
+    board.generate_legal_moves(board.get_active_color(), moves);
+
+    if (depth == 1)
+        return moves.size;
+
+    unsigned long long nodes = 0;
+    for (std::size_t i = 0; i < moves.size; ++i)
+    {
+        board.make_move(moves.moves[i]);
+        nodes += perft(board, depth - 1);
+        board.unmake_move();
+    }
+    return nodes;
+}
+
+/// Node count of every move from the starting position, to compare against other move generators
+void divide(Board &board, int depth)
+{
+    move_list moves;
+    board.generate_legal_moves(board.get_active_color(), moves);
+
+    for (std::size_t i = 0; i < moves.size; ++i)
+    {
+        // Generated moves have to pass the same validation as the ones coming from players
+        Board validated = board;
+        if (!validated.move(moves.moves[i].from, moves.moves[i].to, board.get_active_color()))
+        {
+            std::cerr << "Generated move rejected: " << position_to_string(moves.moves[i].from) << " " << position_to_string(moves.moves[i].to) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        board.make_move(moves.moves[i]);
+        std::cout << position_to_string(moves.moves[i].from) << " " << position_to_string(moves.moves[i].to) << ": " << perft(board, depth - 1) << "\n";
+        board.unmake_move();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int max_depth = argc >= 2 ? atoi(argv[1]) : 4;
+    // Both players have to be present for the board to accept moves
+    Board board(0, 1, 2);
+    const Board initial_board = board;
+
+    if (argc >= 3 && strcmp(argv[2], "divide") == 0)
+    {
+        divide(board, max_depth);
+        return 0;
+    }
+
+    for (int depth = 1; depth <= max_depth; ++depth)
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long nodes = perft(board, depth);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "depth " << depth << ": " << nodes << " nodes, "
+                  << elapsed.count() << " s, "
+                  << static_cast<unsigned long long>(nodes / std::max(elapsed.count(), 1e-9)) << " nodes/s" << std::endl;
+
+        if (!board.state_equal(initial_board) || board.hash() != initial_board.hash())
+        {
+            std::cerr << "Board differs from the starting position after unmaking all moves" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return 0;
+}
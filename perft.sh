@@ -0,0 +1,2 @@
+#!/bin/bash
+g++ perft.cpp board.cpp cells.cpp pieces.cpp -Wall --std=c++20 -O2 -o perft && ./perft "$@"
@@ -20,6 +20,26 @@ enum Color : unsigned short
     NoColor
 };
 
+/// @brief Contents of a single cell, piece in the lower 3 bits and color above them
+typedef unsigned char square;
+
+constexpr square make_square(Piece piece, Color color)
+{
+    return static_cast<square>(piece | (color << 3));
+}
+
+constexpr Piece square_piece(square contents)
+{
+    return static_cast<Piece>(contents & 0x7);
+}
+
+constexpr Color square_color(square contents)
+{
+    return static_cast<Color>(contents >> 3);
+}
+
+constexpr square empty_square = make_square(Piece::NoPiece, Color::NoColor);
+
 std::string piece_to_string(Piece piece);
 
 std::string color_to_string(Color color);
\ No newline at end of file
@@ -1,13 +1,23 @@
 #include "player_control.hpp"
+#include "archive.hpp"
+#include "board_pool.hpp"
+#include "journal.hpp"
+#include "matchmaking.hpp"
+#include "metrics.hpp"
+#include "snapshot.hpp"
+#include "workers.hpp"
 #include <arpa/inet.h>
+#include <algorithm>
+#include <array>
 #include <climits>
 #include <iostream>
 
-std::unordered_set<int> free_gids = {};
-
 namespace player_control
 {
     std::string cheat_board = "WK f6\nBK k1\nBR c3\n";
+    /// Cheat board as sent to the players, encoded once for everyone
+    shared_message cheat_board_message = nullptr;
+    shared_message packed_cheat_board_message = nullptr;
     void initialize_cheat_board()
     {
         auto positions = Board().get_all_positions();
@@ -21,81 +31,305 @@ namespace player_control
                 cheat_board.append("\n");
             }
         }
+
+        Board board;
+        board.load_board(cheat_board);
+        cheat_board_message = make_message(std::format("load\n{}\n", cheat_board));
+        packed_cheat_board_message = make_message(protocol::board_snapshot(board));
+    }
+    thread_local std::unordered_map<int, int> games = {};
+    thread_local std::unordered_map<int, Board *> boards = {};
+    thread_local std::unordered_map<int, outbox> messages = {};
+    thread_local std::vector<int> players_with_output = {};
+    thread_local std::unordered_set<int> binary_players = {};
+    thread_local std::unordered_map<int, std::vector<int>> spectators = {};
+    thread_local std::unordered_map<int, int> watched_games = {};
+    thread_local std::unordered_set<int> recovered_games = {};
+
+    /// Players of the game followed by its spectators
+    std::vector<int> audience(const Board &board, int game_id)
+    {
+        std::vector<int> player_ids = {};
+        if (board.has_white_player())
+            player_ids.push_back(board.get_player_id(Color::White));
+        if (board.has_black_player())
+            player_ids.push_back(board.get_player_id(Color::Black));
+        if (spectators.contains(game_id))
+            player_ids.insert(player_ids.end(), spectators.at(game_id).begin(), spectators.at(game_id).end());
+        return player_ids;
+    }
+
+    shared_message make_message(std::string message)
+    {
+        return std::make_shared<const std::string>(std::move(message));
+    }
+
+    /// Texts of the statuses that always say the same
+    const std::array<const char *, 20> fixed_status_texts = {
+        "accepted\n", "blocked\n", "Waiting for other player\n", "Black player joined\n", "White player joined\n",
+        "Game started\n", "Opponent left\n", "Loss\n", "Win: walkover\n", "Game is full\n", "Game closed\n",
+        "error: not in a game\n", "error: already joined a game\n", "error: game has already ended\n",
+        "error: still waiting for other player\n", "error: invalid game id\n", "error: invalid rating\n",
+        "error: not enough arguments for move\n", "error: no command\n", "error: no such game\n"};
+
+    const shared_message &status_message(protocol::Status status)
+    {
+        // Built by every thread for itself, so handing one out never bumps a reference count another core uses
+        static thread_local const std::array<shared_message, 256> statuses = []
+        {
+            std::array<shared_message, 256> messages = {};
+            for (std::size_t code = 0; code < messages.size(); ++code)
+                messages[code] = make_message(protocol::status(static_cast<protocol::Status>(code)));
+            return messages;
+        }();
+        return statuses[status];
+    }
+
+    shared_message status_text(std::string_view text)
+    {
+        // Per thread like the binary ones, the keys point into the messages themselves
+        static thread_local const std::unordered_map<std::string_view, shared_message> texts = []
+        {
+            std::unordered_map<std::string_view, shared_message> messages = {};
+            for (const char *fixed : fixed_status_texts)
+            {
+                shared_message message = make_message(fixed);
+                messages.emplace(*message, message);
+            }
+            return messages;
+        }();
+
+        auto found = texts.find(text);
+        return (found == texts.end()) ? make_message(std::string(text)) : found->second;
+    }
+
+    void push_message(const int &player_id, const shared_message &message)
+    {
+        if (message == nullptr || message->empty())
+            return;
+
+        auto &slices = messages.at(player_id).slices;
+        // Outbox was empty, so the player isn't listed yet
+        if (slices.empty())
+            players_with_output.push_back(player_id);
+        slices.push_back(message);
+    }
+
+    void push_message(const int &player_id, const std::string &message)
+    {
+        if (message.empty())
+            return;
+
+        push_message(player_id, make_message(message));
+    }
+
+    void push_status(const int &player_id, protocol::Status status, std::string_view text)
+    {
+        if (binary_players.contains(player_id))
+            push_message(player_id, status_message(status));
+        else if (!text.empty())
+            push_message(player_id, status_text(text));
+    }
+
+    void broadcast(const std::vector<int> &player_ids, const shared_message &text, const shared_message &binary)
+    {
+        for (int player_id : player_ids)
+            push_message(player_id, binary_players.contains(player_id) ? binary : text);
+    }
+
+    void broadcast_status(const std::vector<int> &player_ids, protocol::Status status, std::string_view text)
+    {
+        shared_message text_message = nullptr;
+        for (int player_id : player_ids)
+        {
+            if (binary_players.contains(player_id))
+                push_message(player_id, status_message(status));
+            else
+            {
+                if (text_message == nullptr)
+                    text_message = status_text(text);
+                push_message(player_id, text_message);
+            }
+        }
+    }
+
+    std::vector<int> take_players_with_output()
+    {
+        std::vector<int> players = {};
+        players.swap(players_with_output);
+        return players;
     }
-    std::unordered_map<int, int> games = {};
-    std::unordered_map<int, std::shared_ptr<Board>> boards = {};
-    std::unordered_map<int, std::queue<std::string>> messages = {};
 
-    void clear_players()
+    std::size_t fill_iovecs(const outbox &outbox, iovec *iovecs, std::size_t max_count)
     {
+        std::size_t count = 0;
+        std::size_t offset = outbox.sent;
+        for (const auto &slice : outbox.slices)
+        {
+            if (count == max_count)
+                break;
+
+            iovecs[count].iov_base = const_cast<char *>(slice->data() + offset);
+            iovecs[count].iov_len = slice->size() - offset;
+            ++count;
+            offset = 0;
+        }
+        return count;
+    }
+
+    void consume_sent(outbox &outbox, std::size_t bytes)
+    {
+        while (bytes > 0 && !outbox.slices.empty())
+        {
+            std::size_t left = outbox.slices.front()->size() - outbox.sent;
+            if (bytes < left)
+            {
+                outbox.sent += bytes;
+                return;
+            }
+
+            bytes -= left;
+            outbox.slices.pop_front();
+            outbox.sent = 0;
+        }
+    }
+
+    void clear_players(bool close_connections)
+    {
+        for (const auto &game_board : boards)
+            board_pool::release(game_board.second);
         boards.clear();
-        for (const auto &pidgid : games)
+        // Every player and spectator has an outbox
+        for (const auto &player_outbox : messages)
         {
-            int player_id = pidgid.first;
+            if (!close_connections)
+                break;
+
+            int player_id = player_outbox.first;
             shutdown(player_id, SHUT_RDWR);
             close(player_id);
         }
         games.clear();
+        recovered_games.clear();
+        messages.clear();
+        spectators.clear();
+        watched_games.clear();
+        binary_players.clear();
     }
 
-    void add_player(const int &player_id, int game_id, Color preferred_color)
+    void restore_games()
     {
-        bool cheats = game_id == 42069;
-
-        if (game_id == -1)
+        for (const auto &game : journal::recovered_games())
         {
-            if (!free_gids.empty())
+            if (workers::owner_of_game(game.game_id) != workers::this_worker)
+                continue;
+
+            // Neither the journal nor a snapshot kept the position, the moves alone would start from the wrong one
+            if (game.resumed && game.packed_board.size() != protocol::packed_board_size)
             {
-                auto it = free_gids.begin();
-                game_id = *it;
-                free_gids.erase(it);
+                std::cout << "Game " << game.game_id << " can't be restored without its snapshot" << std::endl;
+                continue;
             }
-            else
+
+            Board *board = board_pool::acquire(game.game_id, game.black_player_id, game.white_player_id, game.cheat_board);
+            // Hasn't started yet, so there is nothing to log, the board is set up once the opponent joins
+            if (game.waiting)
             {
-                // First board without both players or biggest game id +1
-                int next_game_id = 0;
-                for (const auto &gid_board : boards)
-                {
+                boards.insert({game.game_id, board});
+                matchmaking::publish(game.game_id, board->has_white_player() ? Color::Black : Color::White);
+                continue;
+            }
 
-                    if ((preferred_color == Color::NoColor && !gid_board.second->has_both_players()) ||
-                        (preferred_color == Color::Black && !gid_board.second->has_black_player()) ||
-                        (preferred_color == Color::White && !gid_board.second->has_white_player()))
-                    {
-                        next_game_id = gid_board.first;
-                        break;
-                    }
+            if (game.resumed)
+            {
+                board->load_squares(protocol::unpack_board(game.packed_board.data()), game.to_move);
+                archive::resumed_from(game.game_id, game.packed_board);
+            }
+            else if (game.cheat_board)
+                board->load_board(cheat_board);
+            journal::game_started(game.game_id, game.cheat_board, game.resumed ? game.packed_board : "", game.to_move);
 
-                    if (gid_board.first >= next_game_id)
-                        next_game_id = gid_board.first + 1;
-                }
+            std::size_t replayed = 0;
+            while (replayed < game.moves.size() && board->replay_move(game.moves[replayed].from, game.moves[replayed].to))
+            {
+                journal::move_played(game.game_id, game.moves[replayed].from, game.moves[replayed].to);
+                ++replayed;
+            }
+
+            if (replayed < game.moves.size())
+                std::cout << "Game " << game.game_id << " stopped replaying at move " << replayed << std::endl;
 
-                game_id = next_game_id;
+            // Nothing left to play
+            // Archived when it ended in the previous run
+            if (board->has_game_ended())
+            {
+                archive::game_closed(game.game_id);
+                journal::game_closed(game.game_id);
+                snapshot::clear(game.game_id);
+                board_pool::release(board);
+                continue;
             }
+
+            // Journal starts over, so the slot has to point at the new start record
+            if (game.resumed)
+                snapshot::save(*board);
+
+            boards.insert({game.game_id, board});
+            if (!board->has_both_players())
+                recovered_games.insert(game.game_id);
+            std::cout << "Game " << game.game_id << " restored after " << replayed << " move(s)" << std::endl;
         }
 
-        games[player_id] = game_id;
+        // Rewritten journal and slots have to hold the restored games before anything else happens
+        journal::sync();
+        snapshot::flush();
+    }
+
+    void take_seat(const int &player_id, int game_id, bool spectator)
+    {
+        if (spectator)
+        {
+            spectators[game_id].push_back(player_id);
+            watched_games[player_id] = game_id;
+        }
+        else
+            games[player_id] = game_id;
+        messages.try_emplace(player_id);
+    }
+
+    void add_player(const int &player_id, int game_id, Color preferred_color)
+    {
+        bool cheats = game_id == 42069;
+
+        if (game_id == -1)
+            game_id = matchmaking::allocate_game_id();
+
+        // Turned away without a seat, so the connection isn't tied to the game
         if (boards.contains(game_id) and boards.at(game_id)->has_both_players())
         {
-            messages[player_id] = std::queue<std::string>({"Game is full"});
+            messages.try_emplace(player_id);
+            push_status(player_id, protocol::GameFull, "Game is full\n");
             return;
         }
 
+        games[player_id] = game_id;
+
         if (!boards.contains(game_id))
         {
-            Board *board = new Board(game_id,
-                                     ((preferred_color == Color::Black) ? player_id : -1),
-                                     ((preferred_color == Color::White || preferred_color == Color::NoColor) ? player_id : -1),
-                                     cheats);
-            boards.insert({game_id, std::shared_ptr<Board>(board)});
+            Board *board = board_pool::acquire(game_id,
+                                               ((preferred_color == Color::Black) ? player_id : -1),
+                                               ((preferred_color == Color::White || preferred_color == Color::NoColor) ? player_id : -1),
+                                               cheats);
+            boards.insert({game_id, board});
         }
         else
         {
             auto board = boards.at(game_id);
 
             if (board->has_white_player())
-                messages.at(board->get_player_id(Color::White)).push("Black player joined\n");
+                push_status(board->get_player_id(Color::White), protocol::OpponentJoined, "Black player joined\n");
             else if (board->has_black_player())
-                messages.at(board->get_player_id(Color::Black)).push("White player joined\n");
+                push_status(board->get_player_id(Color::Black), protocol::OpponentJoined, "White player joined\n");
 
             if (preferred_color == Color::NoColor)
                 board->player_joined(player_id);
@@ -105,27 +339,50 @@ namespace player_control
 
         cheats = boards.at(game_id)->cheat_board || cheats;
 
-        messages[player_id] = std::queue<std::string>();
-        messages.at(player_id).push(std::format("Connected to game {}\nPlayer id: {}\nColor: {}\n", game_id, player_id, color_to_string(boards.at(game_id)->player_color(player_id))));
+        // Might already hold errors sent before joining
+        messages.try_emplace(player_id);
+        const Color color = boards.at(game_id)->player_color(player_id);
+        if (binary_players.contains(player_id))
+            push_message(player_id, protocol::connected(game_id, player_id, color));
+        else
+            push_message(player_id, std::format("Connected to game {}\nPlayer id: {}\nColor: {}\n", game_id, player_id, color_to_string(color)));
         if (cheats)
-            messages.at(player_id).push(std::format("load\n{}\n", cheat_board));
+            push_message(player_id, binary_players.contains(player_id) ? packed_cheat_board_message : cheat_board_message);
 
-        std::cout << "Player " << player_id << " joined" << std::endl;
+        std::cout << "Player " << player_id << " joined" << '\n';
         if (!boards.at(game_id)->has_both_players())
         {
-            messages.at(player_id).push("Waiting for other player\n");
+            push_status(player_id, protocol::Waiting, "Waiting for other player\n");
+
+            // Let auto-joining players on any worker find this game
+            matchmaking::publish(game_id, boards.at(game_id)->has_white_player() ? Color::Black : Color::White);
         }
         else
         {
-            boards.at(game_id)->reset();
-            if (cheats)
-                boards.at(game_id)->load_board(cheat_board);
-            messages.at(boards.at(game_id)->get_player_id(Color::White)).push("Game started\n");
-            messages.at(boards.at(game_id)->get_player_id(Color::Black)).push("Game started\n");
-            std::cout << "Game " << game_id << " started" << std::endl;
+            // Might have been joined by its id while queued
+            matchmaking::withdraw(game_id);
+            Board &board = *boards.at(game_id);
+            // Recovered games carry on from where the journal left them
+            if (recovered_games.erase(game_id) == 0)
+            {
+                board.reset();
+                if (cheats)
+                    board.load_board(cheat_board);
+                journal::game_started(game_id, cheats);
+            }
+            else
+            {
+                const shared_message text = make_message(std::format("load\n{}\n", board.serialize()));
+                const shared_message binary = make_message(protocol::board_snapshot(board));
+                broadcast({board.get_player_id(Color::White), board.get_player_id(Color::Black)}, text, binary);
+                std::cout << "Game " << game_id << " resumed" << '\n';
+            }
+            broadcast_status(audience(board, game_id), protocol::GameStarted, "Game started\n");
+            std::cout << "Game " << game_id << " started" << '\n';
+            metrics::count(metrics::GamesStarted);
             if (cheats)
             {
-                std::cout << "Cheat board enabled" << std::endl;
+                std::cout << "Cheat board enabled" << '\n';
             }
         }
     }
@@ -135,41 +392,141 @@ namespace player_control
         if (!messages.contains(player_id))
             return;
 
-        if (!games.contains(player_id) || !boards.contains(games.at(player_id)))
-            return;
+        remove_spectator(player_id);
+        matchmaking::take_queued(player_id);
 
-        const bool both_players_present = get_board(player_id)->has_both_players();
+        if (games.contains(player_id) && boards.contains(games.at(player_id)))
+        {
+            auto board = get_board(player_id);
+            const Color color = board->player_color(player_id);
 
-        std::cout << "Player left id " << player_id << "\nBoard white id " << get_board(player_id)->get_player_id(Color::White) << " black id " << get_board(player_id)->get_player_id(Color::Black) << std::endl;
+            std::cout << "Player left id " << player_id << "\nBoard white id " << board->get_player_id(Color::White) << " black id " << board->get_player_id(Color::Black) << '\n';
 
-        if (both_players_present)
-        {
-            if (get_board(player_id)->player_color(player_id) == Color::White)
+            // Holds no seat at this board, nothing to give up
+            if (color == Color::NoColor)
             {
-                messages.at(get_board(player_id)->get_player_id(Color::Black)).push("Opponent left\n");
-                if (!get_board(player_id)->has_game_ended())
-                    messages.at(get_board(player_id)->get_player_id(Color::Black)).push("Win: walkover\n");
             }
-            else if (get_board(player_id)->player_color(player_id) == Color::Black)
+            else if (board->has_both_players())
             {
-                messages.at(get_board(player_id)->get_player_id(Color::White)).push("Opponent left\n");
-                if (!get_board(player_id)->has_game_ended())
-                    messages.at(get_board(player_id)->get_player_id(Color::White)).push("Win: walkover\n");
+                const int opponent_id = board->get_player_id(color == Color::White ? Color::Black : Color::White);
+                push_status(opponent_id, protocol::OpponentLeft, "Opponent left\n");
+                const bool walkover = !board->has_game_ended();
+                if (walkover)
+                    push_status(opponent_id, protocol::WinWalkover, "Win: walkover\n");
+                board->player_left(player_id);
+                if (walkover)
+                {
+                    broadcast_game_over(*board);
+                    metrics::count(metrics::GamesFinished);
+                    archive::game_finished(*board, (color == Color::White) ? player_id : opponent_id, (color == Color::Black) ? player_id : opponent_id);
+                    journal::game_closed(board->get_game_id());
+                    snapshot::clear(board->get_game_id());
+                }
+            }
+            // Last player left
+            else
+            {
+                const int game_id = games.at(player_id);
+                matchmaking::withdraw(game_id);
+                if (spectators.contains(game_id))
+                {
+                    broadcast_status(spectators.at(game_id), protocol::GameClosed, "Game closed\n");
+                    for (int spectator_id : spectators.at(game_id))
+                        watched_games.erase(spectator_id);
+                    spectators.erase(game_id);
+                }
+                board_pool::release(boards.at(game_id));
+                boards.erase(game_id);
+                recovered_games.erase(game_id);
+                archive::game_closed(game_id);
+                journal::game_closed(game_id);
+                snapshot::clear(game_id);
+                matchmaking::release_game_id(game_id);
             }
-            get_board(player_id)->player_left(player_id);
         }
-        // Last player left
-        else
-            boards.erase(games.at(player_id));
 
         games.erase(player_id);
         messages.erase(player_id);
+        binary_players.erase(player_id);
 
         shutdown(player_id, SHUT_RDWR);
         close(player_id);
     }
 
-    std::shared_ptr<Board> get_board(const int &player_id)
+    void add_spectator(const int &spectator_id, int game_id)
+    {
+        messages.try_emplace(spectator_id);
+        if (!boards.contains(game_id))
+        {
+            push_status(spectator_id, protocol::ErrorNoGame, "error: no such game\n");
+            return;
+        }
+
+        const Board &board = *boards.at(game_id);
+        spectators[game_id].push_back(spectator_id);
+        watched_games[spectator_id] = game_id;
+
+        if (binary_players.contains(spectator_id))
+        {
+            push_message(spectator_id, protocol::watching(game_id, board.get_active_color()));
+            push_message(spectator_id, protocol::board_snapshot(board));
+        }
+        else
+        {
+            push_message(spectator_id, std::format("Watching game {}\nTurn: {}\n", game_id, color_to_string(board.get_active_color())));
+            push_message(spectator_id, std::format("load\n{}\n", board.serialize()));
+        }
+
+        std::cout << "Spectator " << spectator_id << " watches game " << game_id << '\n';
+    }
+
+    void remove_spectator(const int &spectator_id)
+    {
+        if (!watched_games.contains(spectator_id))
+            return;
+
+        auto &watchers = spectators.at(watched_games.at(spectator_id));
+        // Order doesn't matter, swap with the last one
+        auto found = std::find(watchers.begin(), watchers.end(), spectator_id);
+        *found = watchers.back();
+        watchers.pop_back();
+
+        if (watchers.empty())
+            spectators.erase(watched_games.at(spectator_id));
+        watched_games.erase(spectator_id);
+    }
+
+    void broadcast_move(const Board &board, int opponent_id, cell_index from, cell_index to)
+    {
+        const int game_id = board.get_game_id();
+        const bool watched = spectators.contains(game_id);
+        const bool binary_opponent = binary_players.contains(opponent_id);
+
+        shared_message text = nullptr, binary = nullptr;
+        if (watched || !binary_opponent)
+            text = make_message(std::format("move {} {}\n", position_to_string(from), position_to_string(to)));
+        if (watched || binary_opponent)
+            binary = make_message(protocol::opponent_move(from, to));
+
+        push_message(opponent_id, binary_opponent ? binary : text);
+        if (watched)
+            broadcast(spectators.at(game_id), text, binary);
+    }
+
+    void broadcast_game_over(const Board &board)
+    {
+        const int game_id = board.get_game_id();
+        if (!board.has_game_ended() || !spectators.contains(game_id))
+            return;
+
+        const Color winner = board.has_white_won() ? Color::White : Color::Black;
+        const std::string reason = board.end_reason();
+        broadcast(spectators.at(game_id),
+                  make_message(std::format("Game over: {} won, {}\n", color_to_string(winner), reason)),
+                  make_message(protocol::game_over(winner, reason)));
+    }
+
+    Board *get_board(const int &player_id)
     {
         return boards.at(games.at(player_id));
     }
@@ -1,23 +1,89 @@
 #pragma once
 
 #include "board.hpp"
+#include "protocol.hpp"
+#include <deque>
 #include <memory>
+#include <string_view>
 #include <poll.h>
-#include <queue>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+/// Immutable message, one buffer is queued to every player receiving it
+typedef std::shared_ptr<const std::string> shared_message;
+
+/// @brief Messages waiting to be sent to a player
+typedef struct outbox
+{
+    std::deque<shared_message> slices;
+    /// Bytes of the first slice that already went out
+    std::size_t sent = 0;
+} outbox;
+
+/// State is per worker thread, a game and both of its players always live on the same worker
 namespace player_control
 {
     void initialize_cheat_board();
     /// player id -> game id
-    extern std::unordered_map<int, int> games;
+    extern thread_local std::unordered_map<int, int> games;
     /// messages to send
-    extern std::unordered_map<int, std::queue<std::string>> messages;
-    /// game id -> game board
-    extern std::unordered_map<int, std::shared_ptr<Board>> boards;
+    extern thread_local std::unordered_map<int, outbox> messages;
+    /// game id -> game board, owned by board_pool
+    extern thread_local std::unordered_map<int, Board *> boards;
+
+    /// game id -> connections watching it
+    extern thread_local std::unordered_map<int, std::vector<int>> spectators;
+    /// spectator id -> game id
+    extern thread_local std::unordered_map<int, int> watched_games;
+
+    /// Players that picked the binary protocol when they connected
+    extern thread_local std::unordered_set<int> binary_players;
+    /// Games rebuilt from the journal that haven't got both players back yet
+    extern thread_local std::unordered_set<int> recovered_games;
 
-    void clear_players();
+    shared_message make_message(std::string message);
+    /// Prebuilt single byte message of the binary protocol
+    const shared_message &status_message(protocol::Status status);
+    /// Prebuilt message if the text is one of the fixed status texts, otherwise a new one
+    shared_message status_text(std::string_view text);
+
+    /// Queues a message and remembers that the player has something to send
+    void push_message(const int &player_id, const shared_message &message);
+    void push_message(const int &player_id, const std::string &message);
+    /// Queues the status byte or the text, depending on the player's protocol
+    void push_status(const int &player_id, protocol::Status status, std::string_view text);
+    /// Same message to many players, each form is encoded at most once.
+    /// Either form may be left empty if none of the players uses that protocol
+    void broadcast(const std::vector<int> &player_ids, const shared_message &text, const shared_message &binary);
+    void broadcast_status(const std::vector<int> &player_ids, protocol::Status status, std::string_view text);
+    /// Players whose outboxes became non-empty since the last call
+    std::vector<int> take_players_with_output();
+
+    /// Points up to max_count iovecs at the unsent bytes, returns how many were used
+    std::size_t fill_iovecs(const outbox &outbox, iovec *iovecs, std::size_t max_count);
+    /// Drops the bytes that went out, partly sent slice stays with its offset
+    void consume_sent(outbox &outbox, std::size_t bytes);
+
+    /// Drops every player and game, closing the connections unless they're being handed to another process
+    void clear_players(bool close_connections = true);
+    /// Rebuilds this worker's games from the journal or the previous process.
+    /// Games with empty seats wait for their players to join them by id again
+    void restore_games();
+    /// Connection handed over by the previous process, its seat in the game is already set on the board
+    void take_seat(const int &player_id, int game_id, bool spectator);
+    /// game_id of -1 starts a new game with an id from matchmaking
     void add_player(const int &player_id, int game_id = -1, Color preferred_color = Color::NoColor);
     void remove_player(const int &player_id);
 
-    std::shared_ptr<Board> get_board(const int &player_id);
+    /// Subscribes the connection to the game's updates, starting with a snapshot of the board
+    void add_spectator(const int &spectator_id, int game_id);
+    void remove_spectator(const int &spectator_id);
+    /// Move played in the game, encoded once for the opponent and every spectator
+    void broadcast_move(const Board &board, int opponent_id, cell_index from, cell_index to);
+    /// Tells the spectators who won and why
+    void broadcast_game_over(const Board &board);
+
+    Board *get_board(const int &player_id);
 }
\ No newline at end of file
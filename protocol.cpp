@@ -0,0 +1,105 @@
+#include "protocol.hpp"
+
+namespace protocol
+{
+    frame decode_frame(const char *data)
+    {
+        return {static_cast<Opcode>(data[0]), static_cast<unsigned char>(data[1]), static_cast<unsigned char>(data[2])};
+    }
+
+    int frame_game_id(const frame &frame)
+    {
+        unsigned short game_id = frame.first | (frame.second << 8);
+        return (game_id == auto_game_id) ? -1 : game_id;
+    }
+
+    int frame_rating(const frame &frame)
+    {
+        return frame.first | (frame.second << 8);
+    }
+
+    Status win_status(const std::string &reason)
+    {
+        if (reason == "king is dead")
+            return Status::WinKingDead;
+        if (reason == "checkmate")
+            return Status::WinCheckmate;
+        if (reason == "walkover")
+            return Status::WinWalkover;
+        return Status::WinStalemate;
+    }
+
+    std::string status(Status status)
+    {
+        return std::string(1, static_cast<char>(status));
+    }
+
+    std::string opponent_move(cell_index from, cell_index to)
+    {
+        return {static_cast<char>(Status::OpponentMove), static_cast<char>(from), static_cast<char>(to)};
+    }
+
+    void append_int(std::string &message, std::uint32_t value)
+    {
+        for (int byte = 0; byte < 4; ++byte)
+            message.push_back(static_cast<char>(value >> (8 * byte)));
+    }
+
+    std::string connected(int game_id, int player_id, Color color)
+    {
+        std::string message = status(Status::Connected);
+        append_int(message, game_id);
+        append_int(message, player_id);
+        message.push_back(static_cast<char>(color));
+        return message;
+    }
+
+    std::string watching(int game_id, Color active_color)
+    {
+        std::string message = status(Status::Watching);
+        append_int(message, game_id);
+        message.push_back(static_cast<char>(active_color));
+        return message;
+    }
+
+    std::string game_over(Color winner, const std::string &reason)
+    {
+        return {static_cast<char>(Status::GameOver), static_cast<char>(winner), static_cast<char>(win_status(reason))};
+    }
+
+    std::string board_snapshot(const Board &board)
+    {
+        return status(Status::BoardSnapshot) + pack_board(board);
+    }
+
+    std::string pack_board(const Board &board)
+    {
+        std::string packed(packed_board_size, '\0');
+
+        for (cell_index cell = 0; cell < cell_count; ++cell)
+        {
+            square contents = board.get_square(cell);
+            unsigned char nibble = 0;
+            if (square_piece(contents) != Piece::NoPiece)
+                nibble = 1 + square_piece(contents) + 6 * square_color(contents);
+
+            packed[cell / 2] |= static_cast<char>(nibble << (4 * (cell % 2)));
+        }
+
+        return packed;
+    }
+
+    std::array<square, cell_count> unpack_board(const char *packed)
+    {
+        std::array<square, cell_count> squares = {};
+        for (cell_index cell = 0; cell < cell_count; ++cell)
+        {
+            const unsigned char nibble = (static_cast<unsigned char>(packed[cell / 2]) >> (4 * (cell % 2))) & 0xF;
+            if (nibble == 0)
+                squares[cell] = empty_square;
+            else
+                squares[cell] = make_square(static_cast<Piece>((nibble - 1) % 6), static_cast<Color>((nibble - 1) / 6));
+        }
+        return squares;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "board.hpp"
+#include "cells.hpp"
+#include <cstddef>
+#include <string>
+
+/// Opt-in binary protocol, a client picks it by sending binary_hello as its very first byte.
+/// Every client frame is frame_size bytes, an opcode followed by two argument bytes.
+/// Server messages start with a status byte, a few of them carry a fixed size payload.
+namespace protocol
+{
+    const unsigned char binary_hello = 0xB1;
+    const std::size_t frame_size = 3;
+    /// Two cells per byte, lower nibble first
+    const std::size_t packed_board_size = (cell_count + 1) / 2;
+    /// Join frame argument asking for any game, otherwise a little endian game id
+    const unsigned short auto_game_id = 0xFFFF;
+
+    enum Opcode : unsigned char
+    {
+        Join = 1,
+        /// Arguments are cell indices
+        Move,
+        Leave,
+        /// Same argument as Join, the connection only receives the game's updates
+        Watch,
+        /// Argument is the player's rating, waits for a pairing tick to find a similar opponent
+        JoinRated,
+    };
+
+    enum Status : unsigned char
+    {
+        Accepted = 1,
+        Blocked,
+        /// Followed by from and to cell indices, spectators get it for moves of both sides
+        OpponentMove,
+        /// Followed by the game id and player id as little endian 32 bit integers, then the color
+        Connected,
+        Waiting,
+        OpponentJoined,
+        GameStarted,
+        OpponentLeft,
+        Loss,
+        WinKingDead,
+        WinCheckmate,
+        WinWalkover,
+        WinStalemate,
+        /// Followed by packed_board_size bytes of packed_board
+        BoardSnapshot,
+        GameFull,
+        ErrorArguments,
+        ErrorGameEnded,
+        ErrorWaiting,
+        ErrorAlreadyJoined,
+        ErrorNotJoined,
+        ErrorUnknownCommand,
+        /// Followed by the game id as a little endian 32 bit integer and the color to move,
+        /// then a BoardSnapshot message
+        Watching,
+        /// Followed by the winner's color and the Win status telling why
+        GameOver,
+        /// Last player left, spectators are no longer watching anything
+        GameClosed,
+        ErrorNoGame,
+    };
+
+    /// @brief Decoded client frame
+    typedef struct frame
+    {
+        Opcode opcode;
+        unsigned char first;
+        unsigned char second;
+    } frame;
+
+    /// Expects at least frame_size bytes
+    frame decode_frame(const char *data);
+    /// Game id of a join frame, -1 for auto
+    int frame_game_id(const frame &frame);
+    int frame_rating(const frame &frame);
+
+    /// Win status matching Board::end_reason
+    Status win_status(const std::string &reason);
+
+    std::string status(Status status);
+    std::string opponent_move(cell_index from, cell_index to);
+    std::string connected(int game_id, int player_id, Color color);
+    std::string board_snapshot(const Board &board);
+    std::string watching(int game_id, Color active_color);
+    std::string game_over(Color winner, const std::string &reason);
+
+    /// 4 bits per cell, 0 is empty, otherwise 1 + piece + 6 * color
+    std::string pack_board(const Board &board);
+    /// Expects packed_board_size bytes made by pack_board
+    std::array<square, cell_count> unpack_board(const char *packed);
+}
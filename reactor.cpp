@@ -0,0 +1,273 @@
+#include "reactor.hpp"
+#include "archive.hpp"
+#include "hot_restart.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+#include "matchmaking.hpp"
+#include "metrics.hpp"
+#include "player_control.hpp"
+#include "server.hpp"
+#include "workers.hpp"
+#include <iostream>
+#include <unordered_set>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace reactor
+{
+    const int max_events = 256;
+    const int wait_timeout_ms = 5000;
+    /// Slices passed to a single sendmsg
+    const std::size_t max_iovecs = 64;
+
+    thread_local int epoll_fd = -1;
+    /// Players with EPOLLOUT armed, because the last send couldn't empty their queue
+    thread_local std::unordered_set<int> waiting_for_writable = {};
+    /// Every connection this worker watches, they're handed over together when the server restarts
+    thread_local std::unordered_set<int> watched_connections = {};
+
+    bool watch(int operation, int fd, uint32_t events)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+
+        if (epoll_ctl(epoll_fd, operation, fd, &event) == -1)
+        {
+            perror("EPOLL CTL");
+            return false;
+        }
+        return true;
+    }
+
+    /// Stops watching the connection without closing it
+    void forget(int player_id)
+    {
+        // Already closed sockets drop out of epoll by themselves
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, player_id, nullptr);
+        waiting_for_writable.erase(player_id);
+        watched_connections.erase(player_id);
+        forget_input(player_id);
+    }
+
+    void disconnect(int player_id)
+    {
+        forget(player_id);
+        std::cout << "Removed player form epoll id " << player_id << '\n';
+
+        // In case player left unsafely
+        if (player_control::messages.contains(player_id))
+            player_control::remove_player(player_id);
+        else
+        {
+            shutdown(player_id, SHUT_RDWR);
+            close(player_id);
+        }
+    }
+
+    /// Everything queued goes out in a single sendmsg, unless the socket buffer fills up
+    const bool send_messages(const int &player_id)
+    {
+        if (!player_control::messages.contains(player_id))
+        {
+            // std::cout << "Player " << player_id << " has not joined yet" << std::endl;
+            return true;
+        }
+
+        auto &outbox = player_control::messages.at(player_id);
+        iovec iovecs[max_iovecs];
+
+        while (!outbox.slices.empty())
+        {
+            msghdr message = {};
+            message.msg_iov = iovecs;
+            message.msg_iovlen = player_control::fill_iovecs(outbox, iovecs, max_iovecs);
+
+            ssize_t bytes_sent = sendmsg(player_id, &message, MSG_NOSIGNAL);
+
+            if (bytes_sent == -1)
+            {
+                // Can't send anything more, move on
+                if (errno == EWOULDBLOCK)
+                    return true;
+
+                if (errno == EINTR)
+                    continue;
+
+                // Something bad actually happened
+                perror("SEND DATA");
+                player_control::remove_player(player_id);
+                return false;
+            }
+
+            player_control::consume_sent(outbox, bytes_sent);
+            metrics::count(metrics::BytesOut, bytes_sent);
+        }
+        return true;
+    }
+
+    /// Sends whatever is queued, EPOLLOUT stays armed only while something is left
+    void flush(int player_id)
+    {
+        if (!player_control::messages.contains(player_id))
+            return;
+
+        if (!send_messages(player_id))
+        {
+            forget(player_id);
+            return;
+        }
+
+        const bool pending = !player_control::messages.at(player_id).slices.empty();
+        if (pending == waiting_for_writable.contains(player_id))
+            return;
+
+        if (pending)
+        {
+            watch(EPOLL_CTL_MOD, player_id, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+            waiting_for_writable.insert(player_id);
+        }
+        else
+        {
+            watch(EPOLL_CTL_MOD, player_id, EPOLLIN | EPOLLRDHUP | EPOLLET);
+            waiting_for_writable.erase(player_id);
+        }
+    }
+
+    /// Edge-triggered, so everything has to be read before going back to epoll_wait
+    void receive(int player_id)
+    {
+        char message_part[4096];
+
+        while (true)
+        {
+            int read_bytes = recv(player_id, message_part, sizeof(message_part), 0);
+
+            if (read_bytes == 0)
+            {
+                disconnect(player_id);
+                return;
+            }
+
+            if (read_bytes == -1)
+            {
+                if (errno == EWOULDBLOCK)
+                    return;
+
+                perror("RECEIVE");
+                disconnect(player_id);
+                return;
+            }
+
+            // Whatever is still in the socket gets read by the new owner
+            if (!handle_input(player_id, message_part, read_bytes))
+            {
+                forget(player_id);
+                return;
+            }
+        }
+    }
+
+    void accept_handoffs()
+    {
+        workers::drain_wake_fd();
+
+        for (auto &connection : workers::take_handoffs())
+        {
+            if (!watch(EPOLL_CTL_ADD, connection.player_id, EPOLLIN | EPOLLRDHUP | EPOLLET))
+            {
+                disconnect(connection.player_id);
+                continue;
+            }
+            watched_connections.insert(connection.player_id);
+
+            if (!handle_handoff(connection))
+                forget(connection.player_id);
+        }
+
+        for (const auto &match : matchmaking::take_matches())
+            if (!handle_match(match))
+                forget(match.player_id);
+    }
+
+    void run_epoll_worker()
+    {
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd == -1)
+        {
+            perror("EPOLL CREATE");
+            return;
+        }
+
+        const int wake_fd = workers::wake_fd();
+        watch(EPOLL_CTL_ADD, wake_fd, EPOLLIN);
+
+        metrics::attach(workers::this_worker);
+        journal::open();
+        archive::open();
+        player_control::restore_games();
+
+        epoll_event events[max_events];
+        while (!workers::stop_requested())
+        {
+            int number_of_events = epoll_wait(epoll_fd, events, max_events, wait_timeout_ms);
+
+            if (number_of_events < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                perror("EPOLL WAIT");
+                break;
+            }
+
+            for (int i = 0; i < number_of_events; ++i)
+            {
+                const int fd = events[i].data.fd;
+
+                if (fd == wake_fd)
+                {
+                    accept_handoffs();
+                    continue;
+                }
+
+                // Hang ups and errors show up as a failed read
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    receive(fd);
+
+                // Client ready to receive
+                if (events[i].events & EPOLLOUT)
+                    flush(fd);
+            }
+
+            // Try sending right away, most messages fit in the socket buffer
+            for (int player_id : player_control::take_players_with_output())
+                flush(player_id);
+
+            // Group commit, everything logged since the last tick goes out together
+            journal::sync_if_due();
+            snapshot::save_if_due();
+            metrics::set(metrics::OpenConnections, watched_connections.size());
+            metrics::set(metrics::ActiveGames, player_control::boards.size());
+        }
+
+        // Whatever is still unread stays in the sockets for the new process
+        const bool handing_over = hot_restart::handing_over();
+        if (handing_over)
+        {
+            accept_handoffs();
+            hot_restart::export_worker(std::vector<int>(watched_connections.begin(), watched_connections.end()));
+        }
+
+        player_control::clear_players(!handing_over);
+        watched_connections.clear();
+        journal::close();
+        archive::close();
+        close(epoll_fd);
+    }
+}
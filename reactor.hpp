@@ -0,0 +1,11 @@
+#pragma once
+
+/// Event loops run by the workers, each one handles only the connections of its own worker
+namespace reactor
+{
+    /// Edge-triggered epoll loop, returns once a stop is requested
+    void run_epoll_worker();
+    /// io_uring loop with multishot receives into provided buffers and batched sends,
+    /// falls back to epoll if the kernel doesn't support it
+    void run_uring_worker();
+}
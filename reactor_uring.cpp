@@ -0,0 +1,536 @@
+#include "reactor.hpp"
+#include "archive.hpp"
+#include "hot_restart.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+#include "matchmaking.hpp"
+#include "metrics.hpp"
+#include "player_control.hpp"
+#include "server.hpp"
+#include "uring.hpp"
+#include "workers.hpp"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace reactor
+{
+    const unsigned ring_entries = 256;
+    const unsigned short receive_group = 0;
+    const unsigned receive_buffer_count = 256;
+    const unsigned receive_buffer_size = 4096;
+    /// Slices passed to a single sendmsg
+    const std::size_t max_iovecs = 64;
+
+    /// Stored in the top byte of user_data, next to the connection generation and fd
+    enum Operation : unsigned char
+    {
+        Wake,
+        Receive,
+        Send,
+        Cancel,
+        ProvideBuffers,
+    };
+
+    /// @brief Connection watched by this worker's ring
+    typedef struct connection
+    {
+        /// Tells completions of a reused fd apart from the ones of the previous connection
+        unsigned generation;
+        bool open;
+        bool receiving;
+        bool sending;
+    } connection;
+
+    /// @brief Slices handed to the kernel, they have to stay put until the send completes
+    typedef struct outgoing
+    {
+        outbox pending;
+        iovec iovecs[max_iovecs];
+        msghdr message;
+    } outgoing;
+
+    thread_local uring::ring ring = {};
+    thread_local uring::buffer_pool receive_buffers = {};
+    thread_local std::unordered_map<int, connection> connections = {};
+    /// user data of the send -> what it sends
+    thread_local std::unordered_map<unsigned long long, outgoing> sends_in_flight = {};
+    thread_local unsigned next_generation = 0;
+    /// Handing the connections over, received bytes are only kept and sends aren't retried
+    thread_local bool draining = false;
+
+    static unsigned long long make_user_data(Operation operation, int fd, unsigned generation)
+    {
+        return static_cast<unsigned long long>(operation) << 56 |
+               static_cast<unsigned long long>(generation & 0xFFFFFF) << 32 |
+               static_cast<unsigned int>(fd);
+    }
+
+    static Operation user_data_operation(unsigned long long user_data)
+    {
+        return static_cast<Operation>(user_data >> 56);
+    }
+
+    static int user_data_fd(unsigned long long user_data)
+    {
+        return static_cast<int>(user_data & 0xFFFFFFFF);
+    }
+
+    static unsigned user_data_generation(unsigned long long user_data)
+    {
+        return (user_data >> 32) & 0xFFFFFF;
+    }
+
+    static io_uring_sqe *next_sqe()
+    {
+        io_uring_sqe *sqe = uring::get_sqe(ring);
+        if (sqe == nullptr)
+            perror("IO_URING SUBMIT");
+        return sqe;
+    }
+
+    static void arm_wake()
+    {
+        io_uring_sqe *sqe = next_sqe();
+        if (sqe == nullptr)
+            return;
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = workers::wake_fd();
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = make_user_data(Operation::Wake, sqe->fd, 0);
+    }
+
+    /// Multishot, keeps delivering into the provided buffers until it fails or gets cancelled
+    static void arm_receive(int player_id)
+    {
+        io_uring_sqe *sqe = next_sqe();
+        if (sqe == nullptr)
+            return;
+
+        connection &player = connections.at(player_id);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = player_id;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = receive_group;
+        sqe->user_data = make_user_data(Operation::Receive, player_id, player.generation);
+        player.receiving = true;
+    }
+
+    static void submit_send(unsigned long long user_data)
+    {
+        io_uring_sqe *sqe = next_sqe();
+        if (sqe == nullptr)
+            return;
+
+        outgoing &send = sends_in_flight.at(user_data);
+        send.message = {};
+        send.message.msg_iov = send.iovecs;
+        send.message.msg_iovlen = player_control::fill_iovecs(send.pending, send.iovecs, max_iovecs);
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = user_data_fd(user_data);
+        sqe->addr = reinterpret_cast<unsigned long long>(&send.message);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = user_data;
+    }
+
+    /// Nothing is in flight for the connection anymore, if it moves to another worker it can go now
+    static void retire_connection(int player_id)
+    {
+        connections.erase(player_id);
+        workers::release_handoff(player_id);
+    }
+
+    /// Stops watching the connection without closing it
+    static void forget_connection(int player_id)
+    {
+        connection &player = connections.at(player_id);
+        player.open = false;
+        forget_input(player_id);
+
+        if (player.receiving)
+        {
+            io_uring_sqe *sqe = next_sqe();
+            if (sqe != nullptr)
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = make_user_data(Operation::Receive, player_id, player.generation);
+                sqe->user_data = make_user_data(Operation::Cancel, player_id, player.generation);
+            }
+        }
+
+        if (!player.receiving && !player.sending)
+            retire_connection(player_id);
+    }
+
+    static void disconnect(int player_id)
+    {
+        forget_connection(player_id);
+        std::cout << "Removed player form ring id " << player_id << '\n';
+
+        // In case player left unsafely
+        if (player_control::messages.contains(player_id))
+            player_control::remove_player(player_id);
+        else
+        {
+            shutdown(player_id, SHUT_RDWR);
+            close(player_id);
+        }
+    }
+
+    /// Everything queued for the player goes out as a single sendmsg
+    static void flush_connection(int player_id)
+    {
+        if (!connections.contains(player_id) || !player_control::messages.contains(player_id))
+            return;
+
+        connection &player = connections.at(player_id);
+        auto &queued = player_control::messages.at(player_id);
+        if (!player.open || player.sending || queued.slices.empty())
+            return;
+
+        // Moved rather than copied, the player's outbox starts over empty
+        unsigned long long user_data = make_user_data(Operation::Send, player_id, player.generation);
+        sends_in_flight[user_data].pending = std::move(queued);
+        queued = outbox();
+        player.sending = true;
+        submit_send(user_data);
+    }
+
+    static void start_connection(const workers::handoff &handoff)
+    {
+        connections[handoff.player_id] = {++next_generation, true, false, false};
+        arm_receive(handoff.player_id);
+
+        if (!handle_handoff(handoff))
+            forget_connection(handoff.player_id);
+    }
+
+    /// Returns the connection the completion belongs to, nullptr if it was for an earlier one on the same fd
+    static connection *current_connection(unsigned long long user_data)
+    {
+        auto found = connections.find(user_data_fd(user_data));
+        if (found == connections.end() || (found->second.generation & 0xFFFFFF) != user_data_generation(user_data))
+            return nullptr;
+        return &found->second;
+    }
+
+    /// data points into the receive buffer picked by the kernel, nullptr if there was none
+    static void handle_received(const io_uring_cqe &cqe, const char *data)
+    {
+        const int player_id = user_data_fd(cqe.user_data);
+        connection *player = current_connection(cqe.user_data);
+        if (player == nullptr)
+            return;
+
+        const bool more = cqe.flags & IORING_CQE_F_MORE;
+        if (!more)
+            player->receiving = false;
+
+        if (!player->open)
+        {
+            // Arrived before the cancel, goes along with the connection if it's moving to another worker
+            workers::handoff *moving = workers::held_handoff(player_id);
+            if (moving != nullptr && cqe.res > 0)
+                moving->pending_input.append(data, cqe.res);
+
+            if (!player->receiving && !player->sending)
+                retire_connection(player_id);
+            return;
+        }
+
+        // Hang ups and errors are left for the new process to find
+        if (draining)
+        {
+            if (cqe.res > 0)
+                buffer_input(player_id, data, cqe.res);
+            return;
+        }
+
+        if (cqe.res == 0)
+        {
+            disconnect(player_id);
+            return;
+        }
+
+        if (cqe.res < 0)
+        {
+            // Ran out of buffers, try again once some come back
+            if (cqe.res == -ENOBUFS)
+            {
+                arm_receive(player_id);
+                return;
+            }
+
+            errno = -cqe.res;
+            perror("RECEIVE");
+            disconnect(player_id);
+            return;
+        }
+
+        if (!handle_input(player_id, data, cqe.res))
+        {
+            forget_connection(player_id);
+            return;
+        }
+
+        if (!more)
+            arm_receive(player_id);
+    }
+
+    static void handle_receive(const io_uring_cqe &cqe)
+    {
+        if (!(cqe.flags & IORING_CQE_F_BUFFER))
+        {
+            handle_received(cqe, nullptr);
+            return;
+        }
+
+        unsigned short buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        handle_received(cqe, uring::buffer_data(receive_buffers, buffer_id));
+
+        // Goes back with the next submit, no extra syscall
+        if (!uring::provide_buffers(ring, receive_buffers, buffer_id, 1, make_user_data(Operation::ProvideBuffers, 0, 0)))
+            perror("IO_URING SUBMIT");
+    }
+
+    static void handle_send(const io_uring_cqe &cqe)
+    {
+        const int player_id = user_data_fd(cqe.user_data);
+        outgoing &send = sends_in_flight.at(cqe.user_data);
+        connection *player = current_connection(cqe.user_data);
+
+        if (draining && player != nullptr && player->open)
+        {
+            if (cqe.res > 0)
+                player_control::consume_sent(send.pending, cqe.res);
+
+            // Goes out from the new process, ahead of anything queued since
+            auto queued = player_control::messages.find(player_id);
+            if (queued != player_control::messages.end())
+            {
+                send.pending.slices.insert(send.pending.slices.end(), queued->second.slices.begin(), queued->second.slices.end());
+                queued->second = std::move(send.pending);
+            }
+            sends_in_flight.erase(cqe.user_data);
+            player->sending = false;
+            return;
+        }
+
+        if (player != nullptr && player->open)
+        {
+            if (cqe.res == -EAGAIN || cqe.res == -EINTR)
+            {
+                submit_send(cqe.user_data);
+                return;
+            }
+
+            if (cqe.res > 0)
+            {
+                player_control::consume_sent(send.pending, cqe.res);
+                metrics::count(metrics::BytesOut, cqe.res);
+                if (!send.pending.slices.empty())
+                {
+                    submit_send(cqe.user_data);
+                    return;
+                }
+            }
+        }
+
+        sends_in_flight.erase(cqe.user_data);
+        if (player == nullptr)
+            return;
+
+        player->sending = false;
+        if (!player->open)
+        {
+            if (!player->receiving)
+                retire_connection(player_id);
+            return;
+        }
+
+        if (cqe.res < 0)
+        {
+            // Something bad actually happened
+            errno = -cqe.res;
+            perror("SEND DATA");
+            disconnect(player_id);
+            return;
+        }
+
+        // More could have been queued while this one was in flight
+        flush_connection(player_id);
+    }
+
+    static void handle_wake(const io_uring_cqe &cqe)
+    {
+        // Nothing new is taken on while handing over
+        if (draining)
+            return;
+
+        workers::drain_wake_fd();
+        for (const auto &handoff : workers::take_handoffs())
+            start_connection(handoff);
+        for (const auto &match : matchmaking::take_matches())
+            if (!handle_match(match))
+                forget_connection(match.player_id);
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            arm_wake();
+    }
+
+    static void handle_completions()
+    {
+        while (io_uring_cqe *cqe = uring::peek_cqe(ring))
+        {
+            const io_uring_cqe completion = *cqe;
+            uring::cqe_seen(ring);
+
+            switch (user_data_operation(completion.user_data))
+            {
+            case Operation::Wake:
+                handle_wake(completion);
+                break;
+            case Operation::Receive:
+                handle_receive(completion);
+                break;
+            case Operation::Send:
+                handle_send(completion);
+                break;
+            case Operation::Cancel:
+            case Operation::ProvideBuffers:
+                break;
+            }
+        }
+    }
+
+    /// Takes in the last handoffs, then stops every receive and waits for the sends,
+    /// so the unhandled input and unsent output of each connection can be handed over
+    static void drain_connections()
+    {
+        workers::drain_wake_fd();
+        for (const auto &handoff : workers::take_handoffs())
+            start_connection(handoff);
+        for (const auto &match : matchmaking::take_matches())
+            if (!handle_match(match))
+                forget_connection(match.player_id);
+
+        draining = true;
+        for (const auto &[player_id, player] : connections)
+        {
+            if (!player.open || !player.receiving)
+                continue;
+
+            io_uring_sqe *sqe = next_sqe();
+            if (sqe == nullptr)
+                continue;
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = make_user_data(Operation::Receive, player_id, player.generation);
+            sqe->user_data = make_user_data(Operation::Cancel, player_id, player.generation);
+        }
+
+        auto in_flight = [](const auto &entry)
+        { return entry.second.receiving || entry.second.sending; };
+        while (std::any_of(connections.begin(), connections.end(), in_flight))
+        {
+            int result = uring::submit(ring, 1);
+            if (result < 0 && result != -EBUSY && result != -EINTR)
+            {
+                errno = -result;
+                perror("IO_URING ENTER");
+                break;
+            }
+            handle_completions();
+        }
+    }
+
+    void run_uring_worker()
+    {
+        if (!uring::setup(ring, ring_entries))
+        {
+            perror("IO_URING SETUP");
+            run_epoll_worker();
+            return;
+        }
+
+        uring::create_buffers(receive_buffers, receive_group, receive_buffer_count, receive_buffer_size);
+        if (!uring::provide_buffers(ring, receive_buffers, 0, receive_buffer_count, make_user_data(Operation::ProvideBuffers, 0, 0)))
+        {
+            perror("IO_URING BUFFERS");
+            uring::destroy(ring);
+            run_epoll_worker();
+            return;
+        }
+
+        // Another ring must not read a moving connection until this one's receive is drained
+        workers::hold_handoffs();
+        metrics::attach(workers::this_worker);
+        journal::open();
+        archive::open();
+        player_control::restore_games();
+
+        arm_wake();
+        while (!workers::stop_requested())
+        {
+            // Sends queued during the last batch go out together with the wait
+            int result = uring::submit(ring, 1);
+            // Busy means completions have to be reaped first
+            if (result < 0 && result != -EBUSY)
+            {
+                if (result == -EINTR)
+                    continue;
+
+                errno = -result;
+                perror("IO_URING ENTER");
+                break;
+            }
+
+            handle_completions();
+
+            for (int player_id : player_control::take_players_with_output())
+                flush_connection(player_id);
+
+            // Group commit, everything logged since the last tick goes out together
+            journal::sync_if_due();
+            snapshot::save_if_due();
+            metrics::set(metrics::OpenConnections, connections.size());
+            metrics::set(metrics::ActiveGames, player_control::boards.size());
+        }
+
+        const bool handing_over = hot_restart::handing_over();
+        if (handing_over)
+        {
+            drain_connections();
+            std::vector<int> open_connections = {};
+            for (const auto &[player_id, player] : connections)
+                if (player.open)
+                    open_connections.push_back(player_id);
+            hot_restart::export_worker(open_connections);
+        }
+        // Still receiving when the server stops, the connections are closed anyway
+        workers::release_handoffs();
+
+        player_control::clear_players(!handing_over);
+        journal::close();
+        archive::close();
+        draining = false;
+
+        // Closing the ring cancels everything still in flight, only then the buffers can go
+        uring::destroy(ring);
+        receive_buffers = {};
+        sends_in_flight.clear();
+        connections.clear();
+    }
+}
@@ -0,0 +1,513 @@
+#include "server.hpp"
+#include "archive.hpp"
+#include "board.hpp"
+#include "journal.hpp"
+#include "matchmaking.hpp"
+#include "metrics.hpp"
+#include "player_control.hpp"
+#include "protocol.hpp"
+#include "snapshot.hpp"
+#include "workers.hpp"
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <charconv>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/// @brief Bytes received from a player that don't make a whole command yet
+typedef struct input_buffer
+{
+    std::string data;
+    /// Everything before it has already been handled
+    std::size_t start;
+    /// First byte arrived, so the protocol is known
+    bool negotiated;
+} input_buffer;
+
+thread_local std::unordered_map<int, input_buffer> input_buffers = {};
+
+std::string take_input(const int &player_id)
+{
+    auto found = input_buffers.find(player_id);
+    if (found == input_buffers.end())
+        return "";
+
+    std::string rest = found->second.data.substr(found->second.start);
+    input_buffers.erase(found);
+    return rest;
+}
+
+/// @brief Commands of the text protocol
+enum Verb : unsigned char
+{
+    Join,
+    Move,
+    Leave,
+    Watch,
+    Stats,
+    NoVerb
+};
+
+/// Picks the verb by its length and first letter, then confirms the whole word
+Verb parse_verb(std::string_view word)
+{
+    switch (word.size())
+    {
+    case 4:
+        if (word[0] == 'j' && word == "join")
+            return Verb::Join;
+        if (word[0] == 'm' && word == "move")
+            return Verb::Move;
+        break;
+    case 5:
+        if (word[0] == 'l' && word == "leave")
+            return Verb::Leave;
+        if (word[0] == 'w' && word == "watch")
+            return Verb::Watch;
+        if (word[0] == 's' && word == "stats")
+            return Verb::Stats;
+        break;
+    }
+    return Verb::NoVerb;
+}
+
+/// Cuts the next space separated word off the front of the command
+std::string_view next_word(std::string_view &command)
+{
+    std::size_t start = command.find_first_not_of(' ');
+    if (start == std::string_view::npos)
+    {
+        command = {};
+        return {};
+    }
+
+    std::size_t end = command.find(' ', start);
+    if (end == std::string_view::npos)
+        end = command.size();
+
+    std::string_view word = command.substr(start, end - start);
+    command.remove_prefix(end);
+    return word;
+}
+
+/// -1 if it's not a rating
+int parse_rating(std::string_view word)
+{
+    int rating = -1;
+    auto [end, error] = std::from_chars(word.data(), word.data() + word.size(), rating);
+    if (error != std::errc() || end != word.data() + word.size() || rating < 0 || rating > max_rating)
+        return -1;
+    return rating;
+}
+
+/// -1 for auto, -2 if it's not a game id
+int parse_game_id(std::string_view word)
+{
+    if (word == "auto")
+        return -1;
+
+    int game_id = -2;
+    auto [end, error] = std::from_chars(word.data(), word.data() + word.size(), game_id);
+    if (error != std::errc() || end != word.data() + word.size() || game_id < 0)
+        return -2;
+    return game_id;
+}
+
+/// Errors can reach players that haven't joined yet, so the outbox may have to be made first
+void push_error(const int &player_id, protocol::Status status, std::string_view text)
+{
+    player_control::messages.try_emplace(player_id);
+    player_control::push_status(player_id, status, text);
+}
+
+/// Playing, watching or waiting for a rated opponent, a connection takes part in one game at a time
+bool already_in_game(const int &player_id)
+{
+    if (!player_control::games.contains(player_id) && !player_control::watched_games.contains(player_id) &&
+        !matchmaking::is_queued(player_id))
+        return false;
+
+    push_error(player_id, protocol::ErrorAlreadyJoined, "error: already joined a game\n");
+    return true;
+}
+
+/// Games live on the worker picked by their id, false if the connection had to move there
+bool stays_on_this_worker(const int &player_id, int game_id, bool watch)
+{
+    if (game_id < 0 || workers::owner_of_game(game_id) == workers::this_worker)
+        return true;
+
+    const bool binary = player_control::binary_players.contains(player_id);
+    player_control::messages.erase(player_id);
+    player_control::binary_players.erase(player_id);
+
+    // Commands pipelined after the join go along with it
+    workers::hand_off(workers::owner_of_game(game_id), {player_id, game_id, watch, binary, take_input(player_id)});
+    return false;
+}
+
+/// game_id of -1 joins any game, false if the connection moved to another worker
+bool join_game(const int &player_id, int game_id)
+{
+    if (already_in_game(player_id))
+        return true;
+
+    if (game_id == -1)
+        game_id = matchmaking::claim();
+
+    if (!stays_on_this_worker(player_id, game_id, false))
+        return false;
+
+    player_control::add_player(player_id, game_id);
+    return true;
+}
+
+void join_rated(const int &player_id, int rating)
+{
+    if (already_in_game(player_id))
+        return;
+
+    player_control::messages.try_emplace(player_id);
+    matchmaking::queue_rated(player_id, rating);
+    player_control::push_status(player_id, protocol::Waiting, std::format("Looking for opponent near rating {}\n", rating));
+}
+
+bool watch_game(const int &player_id, int game_id)
+{
+    if (already_in_game(player_id))
+        return true;
+
+    if (!stays_on_this_worker(player_id, game_id, true))
+        return false;
+
+    player_control::add_spectator(player_id, game_id);
+    return true;
+}
+
+void play_move(const int &player_id, cell_index from, cell_index to)
+{
+    // Board could have been closed under a stale mapping
+    if (!player_control::games.contains(player_id) || !player_control::boards.contains(player_control::games.at(player_id)))
+    {
+        push_error(player_id, protocol::ErrorNotJoined, "error: not in a game\n");
+        return;
+    }
+
+    auto board = player_control::get_board(player_id);
+    if (board->has_game_ended())
+    {
+        player_control::push_status(player_id, protocol::ErrorGameEnded, "error: game has already ended\n");
+        return;
+    }
+
+    if (!board->has_both_players())
+    {
+        player_control::push_status(player_id, protocol::ErrorWaiting, "error: still waiting for other player\n");
+        return;
+    }
+
+    const Color color = board->player_color(player_id);
+    if (!board->move(from, to, color))
+    {
+        metrics::count(metrics::MovesBlocked);
+        player_control::push_status(player_id, protocol::Blocked, "blocked\n");
+        return;
+    }
+
+    metrics::count(metrics::MovesAccepted);
+    journal::move_played(board->get_game_id(), from, to);
+    player_control::push_status(player_id, protocol::Accepted, "accepted\n");
+    int other_player_id = board->get_player_id(color == Color::White ? Color::Black : Color::White);
+    player_control::broadcast_move(*board, other_player_id, from, to);
+
+    if (board->has_game_ended())
+    {
+        const std::string reason = board->end_reason();
+        const bool mover_won = (color == Color::White) ? board->has_white_won() : board->has_black_won();
+        const int winner_id = mover_won ? player_id : other_player_id;
+        const int loser_id = mover_won ? other_player_id : player_id;
+
+        player_control::push_status(winner_id, protocol::win_status(reason), std::format("Win: {}\n", reason));
+        player_control::push_status(loser_id, protocol::Loss, "Loss\n");
+        player_control::broadcast_game_over(*board);
+        metrics::count(metrics::GamesFinished);
+        archive::game_finished(*board, board->get_player_id(Color::White), board->get_player_id(Color::Black));
+        journal::game_closed(board->get_game_id());
+        snapshot::clear(board->get_game_id());
+    }
+}
+
+/// Always false, the connection is closed
+bool leave_game(const int &player_id)
+{
+    if (player_control::messages.contains(player_id))
+        player_control::remove_player(player_id);
+    else
+    {
+        shutdown(player_id, SHUT_RDWR);
+        close(player_id);
+    }
+    return false;
+}
+
+bool handle_action(const int &player_id, std::string_view action)
+{
+    std::string_view rest = action;
+    std::string_view verb = next_word(rest);
+
+    switch (parse_verb(verb))
+    {
+    case Verb::Join:
+    case Verb::Watch:
+    {
+        std::string_view game = next_word(rest);
+        if (game.empty())
+        {
+            push_error(player_id, protocol::ErrorArguments, std::format("error: not enough arguments for {}\n", verb));
+            return true;
+        }
+
+        int game_id = parse_game_id(game);
+        // Only players can be matched automatically
+        if (game_id == -2 || (game_id == -1 && parse_verb(verb) == Verb::Watch))
+        {
+            push_error(player_id, protocol::ErrorArguments, "error: invalid game id\n");
+            return true;
+        }
+
+        if (parse_verb(verb) == Verb::Watch)
+            return watch_game(player_id, game_id);
+
+        std::string_view rating = next_word(rest);
+        if (game_id != -1 || rating.empty())
+            return join_game(player_id, game_id);
+
+        if (parse_rating(rating) == -1)
+        {
+            push_error(player_id, protocol::ErrorArguments, "error: invalid rating\n");
+            return true;
+        }
+        join_rated(player_id, parse_rating(rating));
+        return true;
+    }
+
+    case Verb::Move:
+    {
+        std::string_view from = next_word(rest);
+        std::string_view to = next_word(rest);
+        if (to.empty())
+        {
+            push_error(player_id, protocol::ErrorArguments, "error: not enough arguments for move\n");
+            return true;
+        }
+
+        play_move(player_id, parse_position(from), parse_position(to));
+        return true;
+    }
+
+    case Verb::Leave:
+        return leave_game(player_id);
+
+    case Verb::Stats:
+        player_control::messages.try_emplace(player_id);
+        player_control::push_message(player_id, metrics::report());
+        return true;
+
+    default:
+        if (verb.empty())
+            push_error(player_id, protocol::ErrorUnknownCommand, "error: no command\n");
+        else
+            push_error(player_id, protocol::ErrorUnknownCommand, std::format("unknown command: {}\n", action));
+        return true;
+    }
+}
+
+bool handle_frame(const int &player_id, const protocol::frame &frame)
+{
+    switch (frame.opcode)
+    {
+    case protocol::Join:
+        return join_game(player_id, protocol::frame_game_id(frame));
+    case protocol::Move:
+        play_move(player_id, frame.first, frame.second);
+        return true;
+    case protocol::Leave:
+        return leave_game(player_id);
+    case protocol::JoinRated:
+        join_rated(player_id, protocol::frame_rating(frame));
+        return true;
+    case protocol::Watch:
+        if (protocol::frame_game_id(frame) == -1)
+        {
+            push_error(player_id, protocol::ErrorArguments, "");
+            return true;
+        }
+        return watch_game(player_id, protocol::frame_game_id(frame));
+    default:
+        push_error(player_id, protocol::ErrorUnknownCommand, "");
+        return true;
+    }
+}
+
+bool handle_handoff(const workers::handoff &connection)
+{
+    if (connection.binary)
+        player_control::binary_players.insert(connection.player_id);
+
+    if (!connection.unsent_output.empty())
+    {
+        player_control::messages.try_emplace(connection.player_id);
+        player_control::push_message(connection.player_id, connection.unsent_output);
+    }
+
+    if (connection.seated)
+        player_control::take_seat(connection.player_id, connection.game_id, connection.watch);
+    else if (connection.rating >= 0)
+    {
+        // Already told it's looking for an opponent
+        player_control::messages.try_emplace(connection.player_id);
+        matchmaking::queue_rated(connection.player_id, connection.rating);
+    }
+    else if (connection.game_id >= 0)
+    {
+        const bool stays = connection.watch ? watch_game(connection.player_id, connection.game_id)
+                                            : join_game(connection.player_id, connection.game_id);
+        if (!stays)
+            return false;
+    }
+
+    return handle_input(connection.player_id, connection.pending_input.data(), connection.pending_input.size());
+}
+
+bool handle_match(const matchmaking::match &match)
+{
+    // Left since the tick paired it, the partner waits for the next one
+    if (!matchmaking::take_queued(match.player_id))
+    {
+        if (match.game_id == -1)
+            matchmaking::requeue(match.partner);
+        // Partner already sits in the game, let anyone take the seat
+        else
+            matchmaking::publish(match.game_id, Color::Black);
+        return true;
+    }
+
+    if (match.game_id != -1)
+        return join_game(match.player_id, match.game_id);
+
+    const int game_id = matchmaking::allocate_game_id();
+    player_control::add_player(match.player_id, game_id);
+    // Seat is kept for the partner
+    matchmaking::withdraw(game_id);
+
+    if (match.partner.worker != workers::this_worker)
+        matchmaking::post_match(match.partner.worker, {match.partner.player_id, game_id, {}});
+    else if (matchmaking::take_queued(match.partner.player_id))
+        player_control::add_player(match.partner.player_id, game_id);
+    else
+        matchmaking::publish(game_id, Color::Black);
+    return true;
+}
+
+bool handle_input(const int &player_id, const char *data, std::size_t length)
+{
+    input_buffer &input = input_buffers[player_id];
+    metrics::count(metrics::BytesIn, length);
+
+    // Protocol is picked by the very first byte of the connection
+    if (!input.negotiated && length > 0)
+    {
+        input.negotiated = true;
+        if (static_cast<unsigned char>(data[0]) == protocol::binary_hello && !player_control::binary_players.contains(player_id))
+        {
+            player_control::binary_players.insert(player_id);
+            ++data;
+            --length;
+        }
+    }
+    input.data.append(data, length);
+
+    const bool binary = player_control::binary_players.contains(player_id);
+    while (true)
+    {
+        bool keep_connection = true;
+        std::chrono::steady_clock::time_point started;
+
+        if (binary)
+        {
+            if (input.data.size() - input.start < protocol::frame_size)
+                break;
+
+            protocol::frame frame = protocol::decode_frame(input.data.data() + input.start);
+            input.start += protocol::frame_size;
+            started = std::chrono::steady_clock::now();
+            keep_connection = handle_frame(player_id, frame);
+        }
+        else
+        {
+            std::size_t end = input.data.find('\n', input.start);
+            if (end == std::string::npos)
+                break;
+
+            // Points into the buffer, nothing is copied
+            std::string_view action = std::string_view(input.data).substr(input.start, end - input.start);
+            input.start = end + 1;
+
+            if (!action.empty() && action.back() == '\r')
+                action.remove_suffix(1);
+            if (action.empty())
+                continue;
+
+            started = std::chrono::steady_clock::now();
+            keep_connection = handle_action(player_id, action);
+        }
+
+        metrics::count(metrics::CommandsHandled);
+        metrics::record_latency(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+
+        if (!keep_connection)
+        {
+            // Connection left or moved to another worker, the buffer goes with it
+            input_buffers.erase(player_id);
+            return false;
+        }
+
+        // Buffer could have been dropped on the way
+        if (!input_buffers.contains(player_id))
+            return true;
+    }
+
+    input_buffer &rest = input_buffers.at(player_id);
+    if (rest.start == rest.data.size())
+    {
+        rest.data.clear();
+        rest.start = 0;
+    }
+    // Keep only the unfinished tail, it's at most one command long
+    else if (rest.start > 0)
+    {
+        rest.data.erase(0, rest.start);
+        rest.start = 0;
+    }
+
+    if (rest.data.size() > max_command_length)
+    {
+        std::cout << "Command too long from player " << player_id << '\n';
+        rest.data.clear();
+        push_error(player_id, protocol::ErrorArguments, "error: command too long\n");
+    }
+
+    return true;
+}
+
+void forget_input(const int &player_id)
+{
+    input_buffers.erase(player_id);
+}
+
+void buffer_input(const int &player_id, const char *data, std::size_t length)
+{
+    input_buffers[player_id].data.append(data, length);
+}
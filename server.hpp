@@ -0,0 +1,41 @@
+#pragma once
+#include "cells.hpp"
+#include "matchmaking.hpp"
+#include "protocol.hpp"
+#include "workers.hpp"
+#include <string>
+#include <string_view>
+
+/// Longest command kept while waiting for its newline
+const std::size_t max_command_length = 1024;
+/// Ratings have to fit the 16 bit argument of the binary protocol
+const int max_rating = 0xFFFF;
+
+/// Commands shared by both protocols, false if this worker should stop watching the connection
+bool join_game(const int &player_id, int game_id);
+/// Waits for a pairing tick to find an opponent with a similar rating
+void join_rated(const int &player_id, int rating);
+bool watch_game(const int &player_id, int game_id);
+void play_move(const int &player_id, cell_index from, cell_index to);
+bool leave_game(const int &player_id);
+
+/// Runs a single text command from the player, false if this worker should stop watching the connection
+bool handle_action(const int &player_id, std::string_view action);
+/// Binary protocol counterpart of handle_action
+bool handle_frame(const int &player_id, const protocol::frame &frame);
+
+/// Sets up a connection that was just given to this worker, false if it moved on again
+bool handle_handoff(const workers::handoff &connection);
+
+/// Starts the game of a rated pair or joins the one started for it, false if the connection moved to another worker
+bool handle_match(const matchmaking::match &match);
+
+/// Buffers received bytes and runs every complete command, newline terminated ones or binary frames,
+/// false if this worker should stop watching the connection
+bool handle_input(const int &player_id, const char *data, std::size_t length);
+/// Drops whatever is left of an unfinished command
+void forget_input(const int &player_id);
+/// Unhandled part of the player's input, removes the buffer
+std::string take_input(const int &player_id);
+/// Keeps received bytes without running them, for connections that are about to leave the process
+void buffer_input(const int &player_id, const char *data, std::size_t length);
@@ -0,0 +1,181 @@
+#include "snapshot.hpp"
+#include "player_control.hpp"
+#include "workers.hpp"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace snapshot
+{
+    const std::size_t file_size = slot_size * slot_count;
+
+    std::string snapshot_path = "";
+    /// Shared by all workers, each one only writes the slots of its own games
+    char *slots = nullptr;
+    /// Bumped by every snapshot tick, workers compare it with the last one they saved
+    std::atomic<unsigned> snapshot_epoch = 0;
+    thread_local unsigned saved_epoch = 0;
+
+    slot *slot_of(int game_id)
+    {
+        if (slots == nullptr || game_id < 0 || static_cast<std::size_t>(game_id) >= slot_count)
+            return nullptr;
+        return reinterpret_cast<slot *>(slots + game_id * slot_size);
+    }
+
+    void set_path(std::string path)
+    {
+        snapshot_path = std::move(path);
+    }
+
+    bool enabled()
+    {
+        return !snapshot_path.empty();
+    }
+
+    bool open()
+    {
+        if (!enabled())
+            return true;
+
+        int fd = ::open(snapshot_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1)
+        {
+            perror("SNAPSHOT OPEN");
+            return false;
+        }
+
+        // Sparse, pages are only allocated for slots that get written
+        if (ftruncate(fd, file_size) == -1)
+        {
+            perror("SNAPSHOT SIZE");
+            ::close(fd);
+            return false;
+        }
+
+        void *mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            perror("SNAPSHOT MMAP");
+            return false;
+        }
+
+        slots = static_cast<char *>(mapping);
+        return true;
+    }
+
+    void close()
+    {
+        if (slots == nullptr)
+            return;
+
+        msync(slots, file_size, MS_SYNC);
+        munmap(slots, file_size);
+        slots = nullptr;
+    }
+
+    void recover()
+    {
+        if (slots == nullptr)
+            return;
+
+        auto &games = journal::recovered_games();
+        std::unordered_map<int, std::size_t> journaled = {};
+        for (std::size_t index = 0; index < games.size(); ++index)
+            journaled[games[index].game_id] = index;
+
+        std::size_t restored = 0;
+        for (std::size_t game_id = 0; game_id < slot_count; ++game_id)
+        {
+            const slot &saved = *slot_of(game_id);
+            if (!saved.live || saved.game_id != game_id)
+                continue;
+
+            journal::recovered_game game = {static_cast<int>(game_id), saved.cheat_board != 0, true,
+                                            saved.worker, saved.start_record, {},
+                                            std::string(saved.packed_board, protocol::packed_board_size),
+                                            static_cast<Color>(saved.to_move)};
+
+            auto found = journaled.find(game_id);
+            if (found == journaled.end())
+            {
+                games.push_back(std::move(game));
+                ++restored;
+                continue;
+            }
+
+            // Same run of the game, the journal has the moves played since the snapshot.
+            // Otherwise the journal hadn't caught up with the game in the slot yet
+            journal::recovered_game &logged = games[found->second];
+            if (logged.worker == saved.worker && logged.start_record == saved.start_record &&
+                logged.moves.size() >= saved.journal_moves)
+                game.moves.assign(logged.moves.begin() + saved.journal_moves, logged.moves.end());
+            logged = std::move(game);
+            ++restored;
+        }
+
+        std::cout << "Recovered " << restored << " game(s) from snapshots" << std::endl;
+    }
+
+    void save(const Board &board)
+    {
+        slot *saved = slot_of(board.get_game_id());
+        if (saved == nullptr)
+            return;
+
+        if (board.has_game_ended())
+        {
+            std::memset(saved, 0, slot_size);
+            return;
+        }
+
+        const journal::game_progress progress = journal::progress(board.get_game_id());
+        const std::string packed = protocol::pack_board(board);
+
+        slot fresh = {1, board.cheat_board, static_cast<unsigned char>(board.get_active_color()),
+                      static_cast<unsigned char>(workers::this_worker), static_cast<std::uint32_t>(board.get_game_id()),
+                      progress.start_record, progress.moves, {}};
+        std::memcpy(fresh.packed_board, packed.data(), protocol::packed_board_size);
+        std::memcpy(saved, &fresh, sizeof(fresh));
+    }
+
+    void clear(int game_id)
+    {
+        slot *saved = slot_of(game_id);
+        if (saved != nullptr)
+            std::memset(saved, 0, slot_size);
+    }
+
+    void request_snapshot()
+    {
+        ++snapshot_epoch;
+        for (std::size_t worker = 0; worker < workers::worker_count; ++worker)
+            workers::wake(worker);
+    }
+
+    void save_if_due()
+    {
+        const unsigned epoch = snapshot_epoch.load(std::memory_order_relaxed);
+        if (slots == nullptr || epoch == saved_epoch)
+            return;
+
+        saved_epoch = epoch;
+        // Games that haven't started keep their slot, it's empty or holds a recovered position
+        for (const auto &game_board : player_control::boards)
+            if (game_board.second->has_both_players() || game_board.second->has_game_ended())
+                save(*game_board.second);
+        flush();
+    }
+
+    void flush()
+    {
+        if (slots != nullptr && msync(slots, file_size, MS_ASYNC) == -1)
+            perror("SNAPSHOT MSYNC");
+    }
+}
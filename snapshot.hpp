@@ -0,0 +1,55 @@
+#pragma once
+#include "board.hpp"
+#include "journal.hpp"
+#include "protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Packed boards of every live game in a memory-mapped file, one fixed-size slot per game id.
+/// Recovery starts games from their slots and only replays the moves journaled after them
+namespace snapshot
+{
+    const std::size_t slot_size = 64;
+    /// Games with bigger ids aren't snapshotted, the journal alone covers them
+    const std::size_t slot_count = 65536;
+
+    /// @brief Saved game, all zeros for a free slot
+    typedef struct slot
+    {
+        unsigned char live;
+        unsigned char cheat_board;
+        unsigned char to_move;
+        /// Worker whose journal logged the game
+        unsigned char worker;
+        std::uint32_t game_id;
+        /// Journal position the board was saved at, moves logged after it are replayed on top
+        journal::record_index start_record;
+        std::uint32_t journal_moves;
+        char packed_board[protocol::packed_board_size];
+    } slot;
+    static_assert(sizeof(slot) <= slot_size, "Snapshot slot has outgrown its size");
+
+    /// Empty path turns snapshots off
+    void set_path(std::string path);
+    bool enabled();
+
+    /// Maps the file, creating it if needed, before the workers start
+    bool open();
+    void close();
+
+    /// Puts the previous run's snapshots into journal::recovered_games, replacing journal replay where they can
+    void recover();
+
+    /// Saves the game's board to its slot
+    void save(const Board &board);
+    /// Frees the game's slot, it's closed or over
+    void clear(int game_id);
+
+    /// Makes every worker save its games, called by the accepting thread on every snapshot tick
+    void request_snapshot();
+    /// Saves every game of this worker if a snapshot was requested since the last one
+    void save_if_due();
+    /// Starts writing the file back without waiting for it
+    void flush();
+}
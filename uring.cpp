@@ -0,0 +1,160 @@
+#include "uring.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace uring
+{
+    bool setup(ring &ring, unsigned entries)
+    {
+        io_uring_params params = {};
+        ring.fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring.fd < 0)
+            return false;
+
+        ring.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        // Both rings share one mapping on every kernel since 5.4
+        const bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_map)
+            ring.sq_map_size = ring.cq_map_size = std::max(ring.sq_map_size, ring.cq_map_size);
+
+        ring.sq_map = mmap(nullptr, ring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+        if (ring.sq_map == MAP_FAILED)
+        {
+            ring.sq_map = nullptr;
+            destroy(ring);
+            return false;
+        }
+
+        if (single_map)
+            ring.cq_map = ring.sq_map;
+        else
+        {
+            ring.cq_map = mmap(nullptr, ring.cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+            if (ring.cq_map == MAP_FAILED)
+            {
+                ring.cq_map = nullptr;
+                destroy(ring);
+                return false;
+            }
+        }
+
+        ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            destroy(ring);
+            return false;
+        }
+        ring.sqes = static_cast<io_uring_sqe *>(sqes);
+
+        char *sq = static_cast<char *>(ring.sq_map);
+        ring.sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        ring.sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        ring.sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        ring.sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        char *cq = static_cast<char *>(ring.cq_map);
+        ring.cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        ring.cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        ring.cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        ring.cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    void destroy(ring &ring)
+    {
+        if (ring.sqes != nullptr)
+            munmap(ring.sqes, ring.sqes_size);
+        if (ring.cq_map != nullptr && ring.cq_map != ring.sq_map)
+            munmap(ring.cq_map, ring.cq_map_size);
+        if (ring.sq_map != nullptr)
+            munmap(ring.sq_map, ring.sq_map_size);
+        if (ring.fd >= 0)
+            close(ring.fd);
+
+        ring = {};
+    }
+
+    io_uring_sqe *get_sqe(ring &ring)
+    {
+        unsigned tail = *ring.sq_tail;
+        if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) > *ring.sq_mask)
+        {
+            // Full, make room without waiting for anything
+            if (submit(ring, 0) < 0)
+                return nullptr;
+            tail = *ring.sq_tail;
+        }
+
+        unsigned index = tail & *ring.sq_mask;
+        io_uring_sqe *sqe = &ring.sqes[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+
+        ring.sq_array[index] = index;
+        __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++ring.unsubmitted;
+
+        return sqe;
+    }
+
+    int submit(ring &ring, unsigned wait_for)
+    {
+        unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int submitted = syscall(__NR_io_uring_enter, ring.fd, ring.unsubmitted, wait_for, flags, nullptr, 0);
+        if (submitted < 0)
+            return -errno;
+
+        ring.unsubmitted -= std::min<unsigned>(submitted, ring.unsubmitted);
+        return submitted;
+    }
+
+    io_uring_cqe *peek_cqe(ring &ring)
+    {
+        unsigned head = *ring.cq_head;
+        if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+            return nullptr;
+
+        return &ring.cqes[head & *ring.cq_mask];
+    }
+
+    void cqe_seen(ring &ring)
+    {
+        __atomic_store_n(ring.cq_head, *ring.cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    void create_buffers(buffer_pool &pool, unsigned short group, unsigned count, unsigned buffer_size)
+    {
+        pool.data.assign(static_cast<std::size_t>(count) * buffer_size, 0);
+        pool.group = group;
+        pool.count = count;
+        pool.buffer_size = buffer_size;
+    }
+
+    bool provide_buffers(ring &ring, const buffer_pool &pool, unsigned short first_id, unsigned count, unsigned long long user_data)
+    {
+        io_uring_sqe *sqe = get_sqe(ring);
+        if (sqe == nullptr)
+            return false;
+
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = count;
+        sqe->addr = reinterpret_cast<unsigned long long>(buffer_data(pool, first_id));
+        sqe->len = pool.buffer_size;
+        sqe->off = first_id;
+        sqe->buf_group = pool.group;
+        sqe->user_data = user_data;
+        return true;
+    }
+
+    const char *buffer_data(const buffer_pool &pool, unsigned short buffer_id)
+    {
+        return pool.data.data() + static_cast<std::size_t>(buffer_id) * pool.buffer_size;
+    }
+}
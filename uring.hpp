@@ -0,0 +1,59 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <vector>
+
+/// Minimal io_uring wrapper over the raw syscalls, just what the server needs
+namespace uring
+{
+    typedef struct ring
+    {
+        int fd = -1;
+
+        unsigned *sq_head = nullptr;
+        unsigned *sq_tail = nullptr;
+        unsigned *sq_mask = nullptr;
+        unsigned *sq_array = nullptr;
+        io_uring_sqe *sqes = nullptr;
+        /// Entries filled since the last io_uring_enter
+        unsigned unsubmitted = 0;
+
+        unsigned *cq_head = nullptr;
+        unsigned *cq_tail = nullptr;
+        unsigned *cq_mask = nullptr;
+        io_uring_cqe *cqes = nullptr;
+
+        void *sq_map = nullptr;
+        void *cq_map = nullptr;
+        std::size_t sq_map_size = 0;
+        std::size_t cq_map_size = 0;
+        std::size_t sqes_size = 0;
+    } ring;
+
+    /// @brief Receive buffers the kernel picks from by itself, handed over with IORING_OP_PROVIDE_BUFFERS
+    typedef struct buffer_pool
+    {
+        std::vector<char> data;
+        unsigned short group = 0;
+        unsigned count = 0;
+        unsigned buffer_size = 0;
+    } buffer_pool;
+
+    /// Sets errno and returns false on failure
+    bool setup(ring &ring, unsigned entries);
+    void destroy(ring &ring);
+
+    /// Cleared submission entry, submits the queued ones first if the ring is full
+    io_uring_sqe *get_sqe(ring &ring);
+    /// Submits everything queued and waits for at least wait_for completions, -errno on failure
+    int submit(ring &ring, unsigned wait_for);
+
+    /// Next completion or nullptr, has to be followed by cqe_seen
+    io_uring_cqe *peek_cqe(ring &ring);
+    void cqe_seen(ring &ring);
+
+    void create_buffers(buffer_pool &pool, unsigned short group, unsigned count, unsigned buffer_size);
+    /// Queues giving count buffers from first_id to the kernel, their completion carries user_data
+    bool provide_buffers(ring &ring, const buffer_pool &pool, unsigned short first_id, unsigned count, unsigned long long user_data);
+    const char *buffer_data(const buffer_pool &pool, unsigned short buffer_id);
+}
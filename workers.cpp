@@ -0,0 +1,172 @@
+#include "workers.hpp"
+#include "sockets.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace workers
+{
+    typedef struct worker
+    {
+        std::thread thread;
+        std::mutex inbox_lock;
+        std::vector<handoff> inbox;
+        /// Read end is polled by the worker, anyone may write to wake it up
+        int wake_pipe[2];
+    } worker;
+
+    std::size_t worker_count = 1;
+    thread_local std::size_t this_worker = 0;
+
+    std::vector<std::unique_ptr<worker>> all_workers = {};
+    std::atomic<bool> stop = false;
+
+    thread_local bool holding = false;
+    /// player id -> worker the connection goes to and its handoff
+    thread_local std::unordered_map<int, std::pair<std::size_t, handoff>> held = {};
+
+    void start(std::size_t count, void (*run)())
+    {
+        worker_count = count;
+        all_workers.clear();
+
+        for (std::size_t index = 0; index < count; ++index)
+        {
+            all_workers.push_back(std::make_unique<worker>());
+            if (pipe(all_workers.back()->wake_pipe) == -1)
+            {
+                perror("WAKE PIPE");
+                exit(EXIT_FAILURE);
+            }
+            set_nonblock(all_workers.back()->wake_pipe[0]);
+            set_nonblock(all_workers.back()->wake_pipe[1]);
+        }
+
+        for (std::size_t index = 0; index < count; ++index)
+            all_workers.at(index)->thread = std::thread([index, run]
+                                                        {
+                                                            this_worker = index;
+                                                            run(); });
+    }
+
+    std::vector<handoff> join()
+    {
+        std::vector<handoff> leftovers = {};
+        for (auto &worker : all_workers)
+        {
+            worker->thread.join();
+            close(worker->wake_pipe[0]);
+            close(worker->wake_pipe[1]);
+        }
+        // Only once every worker stopped, they may still hand connections to each other until then
+        for (auto &worker : all_workers)
+            leftovers.insert(leftovers.end(), worker->inbox.begin(), worker->inbox.end());
+        all_workers.clear();
+        return leftovers;
+    }
+
+    void request_stop()
+    {
+        stop = true;
+        for (std::size_t index = 0; index < all_workers.size(); ++index)
+            wake(index);
+    }
+
+    bool stop_requested()
+    {
+        return stop;
+    }
+
+    std::size_t owner_of_game(int game_id)
+    {
+        return static_cast<std::size_t>(game_id) % worker_count;
+    }
+
+    void deliver(std::size_t worker_index, handoff connection)
+    {
+        worker &target = *all_workers.at(worker_index);
+        {
+            std::lock_guard<std::mutex> guard(target.inbox_lock);
+            target.inbox.push_back(std::move(connection));
+        }
+
+        wake(worker_index);
+    }
+
+    void hand_off(std::size_t worker_index, handoff connection)
+    {
+        if (!holding)
+        {
+            deliver(worker_index, std::move(connection));
+            return;
+        }
+
+        const int player_id = connection.player_id;
+        held.insert_or_assign(player_id, std::make_pair(worker_index, std::move(connection)));
+    }
+
+    void wake(std::size_t worker_index)
+    {
+        char wake = 0;
+        if (write(all_workers.at(worker_index)->wake_pipe[1], &wake, 1) == -1)
+        {
+            // Pipe is full, so the worker is going to wake up anyway
+        }
+    }
+
+    void hold_handoffs()
+    {
+        holding = true;
+    }
+
+    handoff *held_handoff(int player_id)
+    {
+        auto found = held.find(player_id);
+        return (found == held.end()) ? nullptr : &found->second.second;
+    }
+
+    void release_handoff(int player_id)
+    {
+        auto found = held.find(player_id);
+        if (found == held.end())
+            return;
+
+        auto [worker_index, connection] = std::move(found->second);
+        held.erase(found);
+        deliver(worker_index, std::move(connection));
+    }
+
+    void release_handoffs()
+    {
+        while (!held.empty())
+            release_handoff(held.begin()->first);
+    }
+
+    std::vector<handoff> take_handoffs()
+    {
+        worker &current = *all_workers.at(this_worker);
+        std::vector<handoff> connections = {};
+
+        std::lock_guard<std::mutex> guard(current.inbox_lock);
+        connections.swap(current.inbox);
+        return connections;
+    }
+
+    int wake_fd()
+    {
+        return all_workers.at(this_worker)->wake_pipe[0];
+    }
+
+    void drain_wake_fd()
+    {
+        char buffer[256];
+        while (read(wake_fd(), buffer, sizeof(buffer)) > 0)
+        {
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Every worker thread runs its own event loop and owns the players and games handed to it,
+/// so nothing on the hot path is shared between threads
+namespace workers
+{
+    /// @brief Connection passed from one worker to another
+    typedef struct handoff
+    {
+        int player_id;
+        /// Game the player is joining on the new owner, -1 for fresh connections
+        int game_id;
+        /// Joining the game as a spectator
+        bool watch;
+        /// Player already picked the binary protocol
+        bool binary;
+        /// Received before the connection moved, handled by the new owner
+        std::string pending_input;
+        /// Already sits in the game, which came from the previous process
+        bool seated = false;
+        /// Rating the player was waiting with in the previous process, -1 if it wasn't
+        int rating = -1;
+        /// Queued for the player but not sent by the previous process
+        std::string unsent_output = "";
+    } handoff;
+
+    extern std::size_t worker_count;
+    /// Index of the worker running on the current thread
+    extern thread_local std::size_t this_worker;
+
+    void start(std::size_t count, void (*run)());
+    /// Returns the handoffs no worker got to before it stopped
+    std::vector<handoff> join();
+
+    /// Safe to call from a signal handler
+    void request_stop();
+    bool stop_requested();
+
+    /// Games are pinned to workers by their id
+    std::size_t owner_of_game(int game_id);
+
+    void hand_off(std::size_t worker, handoff connection);
+    std::vector<handoff> take_handoffs();
+
+    /// Keeps the handoffs made on this thread until release_handoff, for reactors whose receives
+    /// have to drain before another worker may read the connection
+    void hold_handoffs();
+    /// Handoff of the connection held back on this thread, nullptr if there is none
+    handoff *held_handoff(int player_id);
+    /// Sends the held handoff of the connection on, if there is one
+    void release_handoff(int player_id);
+    /// Sends every handoff held on this thread on
+    void release_handoffs();
+    /// Makes the worker check its inboxes
+    void wake(std::size_t worker);
+
+    /// Becomes readable when this worker has handoffs waiting or should stop
+    int wake_fd();
+    void drain_wake_fd();
+}
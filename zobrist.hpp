@@ -0,0 +1,41 @@
+#pragma once
+#include "cells.hpp"
+#include "pieces.hpp"
+#include <array>
+#include <cstdint>
+
+/// Every value a square can hold fits below this
+const std::size_t square_value_count = 24UL;
+
+typedef struct zobrist_keys
+{
+    /// Key of every square value on every cell, zero for empty cells
+    std::array<std::array<std::uint64_t, square_value_count>, cell_count> squares;
+    /// Mixed in while white is to move
+    std::uint64_t white_to_move;
+} zobrist_keys;
+
+constexpr std::uint64_t splitmix64(std::uint64_t &state)
+{
+    std::uint64_t value = (state += 0x9E3779B97F4A7C15ULL);
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+constexpr zobrist_keys build_zobrist_keys()
+{
+    zobrist_keys keys = {};
+    // Fixed seed, hashes have to be the same in every process
+    std::uint64_t state = 0x676C696E736B69ULL;
+
+    for (cell_index cell = 0; cell < cell_count; ++cell)
+        for (unsigned short color = Color::White; color <= Color::Black; ++color)
+            for (unsigned short piece = Piece::King; piece < Piece::NoPiece; ++piece)
+                keys.squares[cell][make_square(static_cast<Piece>(piece), static_cast<Color>(color))] = splitmix64(state);
+
+    keys.white_to_move = splitmix64(state);
+    return keys;
+}
+
+inline constexpr zobrist_keys zobrist = build_zobrist_keys();